@@ -0,0 +1,27 @@
+/* File:    bench.h
+   Author:  Frank Dischner
+   Purpose: Contains the markers written by the firmware when it is built
+            for cycle counting under a simulator (see host/simbench.c)
+*/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/* marker values written to GPIOR0 */
+#define BENCH_FRAME_START  0x01
+#define BENCH_DECODE_END   0x02
+#define BENCH_RENDER_START 0x03
+#define BENCH_RENDER_END   0x04
+#define BENCH_DONE         0x7F
+/* or'd with the song index */
+#define BENCH_SONG         0x80
+
+#ifdef BENCH
+#include <avr/io.h>
+/* a single 'out' instruction, so markers barely disturb the timing */
+#define BENCH_MARK(m) (GPIOR0 = (m))
+#else
+#define BENCH_MARK(m)
+#endif
+
+#endif /* BENCH_H */
@@ -0,0 +1,59 @@
+/* File:    benchmain.c
+   Author:  Frank Dischner
+   Purpose: Contains the main function for the benchmark firmware, which
+            plays every song for a fixed number of frames without any LCD
+            or controller, so it can be timed under a simulator
+*/
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include "playback.h"
+#include "synth.h"
+#include "songs.h"
+#include "bench.h"
+
+#ifndef BENCH_FRAMES
+#define BENCH_FRAMES 600
+#endif
+
+int main(void)
+{
+    uint8_t song;
+
+    /* initialize playback engine */
+    playback_init();
+    /* initialize song data */
+    songs_init();
+
+    /* enable interrupts to get playback going */
+    sei();
+
+    for (song = 0; song < num_songs(); song++)
+    {
+        playback_stop();
+        playback_set_song(cur_song_data(), cur_song_keyframes());
+
+        /* let the simulator know which song the following frames belong to */
+        BENCH_MARK(BENCH_SONG | song);
+        playback_play();
+
+        while (synth_get_frame() < BENCH_FRAMES)
+        {
+            playback_update();
+            playback_wait();
+        }
+
+        next_song();
+    }
+
+    BENCH_MARK(BENCH_DONE);
+
+    /* sleeping with interrupts disabled stops the simulator */
+    cli();
+    sleep_enable();
+    sleep_cpu();
+
+    return 0;
+}
@@ -1,11 +1,14 @@
 /* File:    controller.c
    Author:  Frank Dischner
-   Purpose: Contains implementations of all NES controller routines
+   Purpose: Contains implementations of all NES controller routines. The
+            controller is read in the background by the timer 2 interrupt,
+            one step of its shift register protocol per interrupt, so
+            reading it never waits.
 */
 
 #include <stdint.h>
-#include <util/delay.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
 
 /* defines to make code more readable */
 #define NES_DDR    DDRD
@@ -15,6 +18,25 @@
 #define NES_LATCH  (1 << PD5)
 #define NES_DATA   (1 << PD6)
 
+/* timer 2 counts per step, 12us with the 1/8 prescaler at 20MHz, */
+/* which is as long as the latch pulse and twice the clock pulses */
+/* the busy waiting version used */
+#define STEP_COUNTS 30
+/* interrupts per read, the latch pulse and two per button */
+#define READ_STEPS 17
+/* calls to nes_controller_read per read of the controller, which */
+/* reads it at about 90Hz with the main loop running once per chunk */
+#define READ_CALLS 4
+
+/* buttons from the last finished read */
+static volatile uint8_t buttons = 0;
+/* steps left in the current read, or zero if there is none */
+static volatile uint8_t steps = 0;
+/* buttons read so far */
+static uint8_t shift = 0;
+/* calls left until the next read */
+static uint8_t calls = 0;
+
 void nes_controller_init(void)
 {
     /* set clock and latch as outputs */
@@ -24,32 +46,61 @@ void nes_controller_init(void)
     /* set initial clock and latch levels */
     NES_PORT &= ~NES_CLK;
     NES_PORT &= ~NES_LATCH;
+
+    /* set reset on OCR2A match and start timer with 1/8 prescaler */
+    /* its interrupt is only enabled while reading */
+    TCCR2A = 0x02;
+    TCCR2B = 0x02;
+    OCR2A = STEP_COUNTS - 1;
+    TIMSK2 = 0x00;
 }
 
-uint8_t nes_controller_read(void)
+ISR(TIMER2_COMPA_vect)
 {
-    uint8_t buttons = 0;
-    uint8_t i;
+    uint8_t s = --steps;
 
-    /* latch button state */
-    NES_PORT |= NES_LATCH;
-    _delay_us(12);
-    NES_PORT &= ~NES_LATCH;
+    /* end of the latch pulse */
+    if (s == READ_STEPS - 1)
+        NES_PORT &= ~NES_LATCH;
 
-    for (i = 0; i < 8; i++)
+    if (!s)
     {
-        /* read input */
-        buttons >>= 1;
+        /* NES buttons are active low */
+        buttons = ~shift;
+        /* done until the next read */
+        TIMSK2 = 0x00;
+    }
+    else if (s & 1)
+    {
+        /* end of the clock pulse */
+        NES_PORT &= ~NES_CLK;
+    }
+    else
+    {
+        /* read input, then clock out the next one */
+        shift >>= 1;
         if (NES_PINS & NES_DATA)
-            buttons |= 0x80;
-        _delay_us(6);
+            shift |= 0x80;
         NES_PORT |= NES_CLK;
-        _delay_us(6);
-        NES_PORT &= ~NES_CLK;
     }
+}
+
+/* returns the buttons from the last finished read, which is at most */
+/* a few milliseconds old, and starts a new read every READ_CALLS calls */
+uint8_t nes_controller_read(void)
+{
+    if (!steps && !calls--)
+    {
+        calls = READ_CALLS - 1;
 
-    /* NES buttons are active low */
-    buttons = ~buttons;
+        /* latch button state until the first step */
+        NES_PORT |= NES_LATCH;
+        steps = READ_STEPS;
+        TCNT2 = 0x00;
+        /* clear any old match, then enable match interrupt */
+        TIFR2 = 0x02;
+        TIMSK2 = 0x02;
+    }
 
     return buttons;
 }
@@ -0,0 +1,289 @@
+/* File:    batch.c
+   Author:  Frank Dischner
+   Purpose: Contains a host program which renders every song, or a clip of
+            each, to its own WAV file, running several songs at once
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "platform.h"
+#include "synth.h"
+#include "songs.h"
+#include "wavfile.h"
+
+/* default to one minute of audio */
+#define DEFAULT_FRAMES (60 * 60)
+
+/* the synthesis core keeps its state in file-static variables, so */
+/* each song is rendered by a worker process of its own */
+#define MAX_SONGS 64
+
+struct job
+{
+    int song;
+    pid_t pid;
+    struct timespec start;
+};
+
+static unsigned long frames = DEFAULT_FRAMES;
+static unsigned long seek = 0;
+static unsigned long rate = SAMPLE_RATE;
+static unsigned long fps = FRAME_RATE;
+static const char *dir = ".";
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-j jobs] [-t frame] [-f frames] [-a rate] [-p]\n"
+            "          [-d dir] [song ...]\n"
+            "  -j jobs    songs to render at once (default: one per CPU)\n"
+            "  -t frame   start each song at this frame, using the seek index\n"
+            "  -f frames  number of frames to render (default %d)\n"
+            "  -a rate    output sample rate, %d-%d (default %d)\n"
+            "  -p         play at the PAL frame rate of %d fps instead of %d\n"
+            "  -d dir     directory to write the files to (default .)\n"
+            "songs are given by index, and default to all of them\n",
+            prog, DEFAULT_FRAMES, MIN_SAMPLE_RATE, MAX_SAMPLE_RATE,
+            SAMPLE_RATE, FRAME_RATE_PAL, FRAME_RATE_NTSC);
+}
+
+/* make a file name from the song's index and name, like */
+/* 02-castlevania-vampire-killer.wav */
+static void file_name(char *buf, size_t size, int song)
+{
+    uint32_t addr = cur_song_name();
+    size_t len;
+    char c;
+    int gap = 0;
+
+    len = snprintf(buf, size, "%s/%02d-", dir, song);
+    while ((c = platform_read_byte(addr++)) && len + 6 < size)
+    {
+        if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9'))
+        {
+            if (gap)
+                buf[len++] = '-';
+            buf[len++] = c;
+            gap = 0;
+        }
+        else if (c >= 'A' && c <= 'Z')
+        {
+            if (gap)
+                buf[len++] = '-';
+            buf[len++] = c - 'A' + 'a';
+            gap = 0;
+        }
+        else if (buf[len - 1] != '-')
+        {
+            gap = 1;
+        }
+    }
+    strcpy(&buf[len], ".wav");
+}
+
+/* render one song, in a worker process */
+/* returns the exit status for the worker */
+static int render(int song)
+{
+    static uint8_t buf[MAX_SAMPLES_PER_FRAME * SAMPLE_BYTES];
+    char name[256];
+    uint16_t frame_samples;
+    unsigned long i;
+    FILE *out;
+
+    for (i = 0; i < (unsigned long) song; i++)
+        next_song();
+
+    synth_set_rate(rate, fps);
+    frame_samples = synth_samples_per_frame();
+
+    synth_set_song(cur_song_data());
+    synth_set_keyframes(cur_song_keyframes());
+    synth_reset();
+
+    if (seek && synth_seek(seek) != seek)
+    {
+        fprintf(stderr, "seeking to frame %lu needs too long a replay\n",
+                seek);
+        return 1;
+    }
+
+    file_name(name, sizeof(name), song);
+    if (!(out = fopen(name, "wb")))
+    {
+        perror(name);
+        return 1;
+    }
+
+    wavfile_write_header(out, frames * frame_samples, rate);
+    for (i = 0; i < frames; i++)
+    {
+        synth_process_events();
+        synth_render(buf, frame_samples);
+        wavfile_to_pcm(buf, frame_samples);
+        fwrite(buf, SAMPLE_BYTES, frame_samples, out);
+    }
+
+    if (fclose(out))
+    {
+        perror(name);
+        return 1;
+    }
+
+    return 0;
+}
+
+static double elapsed(const struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start->tv_sec) +
+           (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    static int songs[MAX_SONGS];
+    static struct job jobs[MAX_SONGS];
+    struct timespec start;
+    long jobs_max = 0;
+    int count = 0, next = 0, running = 0, failed = 0;
+    int i, opt;
+
+    while ((opt = getopt(argc, argv, "j:t:f:a:pd:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'j':
+                jobs_max = strtol(optarg, NULL, 0);
+                break;
+            case 't':
+                seek = strtoul(optarg, NULL, 0);
+                break;
+            case 'f':
+                frames = strtoul(optarg, NULL, 0);
+                break;
+            case 'a':
+                rate = strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                fps = FRAME_RATE_PAL;
+                break;
+            case 'd':
+                dir = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    songs_init();
+
+    if (rate < MIN_SAMPLE_RATE || rate > MAX_SAMPLE_RATE)
+    {
+        fprintf(stderr, "sample rate must be %d-%d\n", MIN_SAMPLE_RATE,
+                MAX_SAMPLE_RATE);
+        return 1;
+    }
+
+    if (optind == argc)
+    {
+        for (count = 0; count < num_songs(); count++)
+            songs[count] = count;
+    }
+    for (i = optind; i < argc && count < MAX_SONGS; i++)
+    {
+        int j;
+
+        songs[count] = atoi(argv[i]);
+        if (songs[count] < 0 || songs[count] >= num_songs())
+        {
+            fprintf(stderr, "invalid song index %s\n", argv[i]);
+            return 1;
+        }
+
+        /* a song given twice is only rendered once, since two */
+        /* workers would otherwise write the same file at once */
+        for (j = 0; j < count; j++)
+        {
+            if (songs[j] == songs[count])
+                break;
+        }
+        if (j == count)
+            count++;
+    }
+
+    if (jobs_max < 1)
+        jobs_max = sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs_max < 1)
+        jobs_max = 1;
+
+    /* keep up to jobs_max workers going until every song is done */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    fflush(NULL);
+    while (next < count || running)
+    {
+        int status;
+        pid_t pid;
+
+        if (next < count && running < jobs_max)
+        {
+            struct job *j = &jobs[next];
+
+            j->song = songs[next++];
+            clock_gettime(CLOCK_MONOTONIC, &j->start);
+            if ((j->pid = fork()) < 0)
+            {
+                perror("fork");
+                return 1;
+            }
+            if (!j->pid)
+                _exit(render(j->song));
+            running++;
+            continue;
+        }
+
+        if ((pid = wait(&status)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("wait");
+            return 1;
+        }
+        running--;
+
+        for (i = 0; i < next; i++)
+        {
+            if (jobs[i].pid == pid)
+                break;
+        }
+        if (i == next)
+            continue;
+
+        if (WIFEXITED(status) && !WEXITSTATUS(status))
+        {
+            fprintf(stderr, "%2d done in %.2f s\n", jobs[i].song,
+                    elapsed(&jobs[i].start));
+        }
+        else
+        {
+            fprintf(stderr, "%2d failed\n", jobs[i].song);
+            failed++;
+        }
+    }
+
+    fprintf(stderr, "%d songs, %lu frames each, in %.2f s with %ld jobs\n",
+            count, frames, elapsed(&start), jobs_max);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,358 @@
+/* File:    envpack.c
+   Author:  Frank Dischner
+   Purpose: Contains a host program which shrinks a song .inc file by
+            replacing runs of frame by frame volume and step writes with
+            single envelope and sweep events, which the synthesis core
+            then steps through on its own. It also marks the keyframe
+            points used by the seek index (see host/seekgen.c).
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "songfile.h"
+
+/* limits of the envelope and sweep operands (see synth.c) */
+#define MAX_STEPS  15
+#define MAX_PERIOD 15
+#define MAX_LENGTH 255
+
+struct event
+{
+    unsigned long frame;
+    uint8_t bytes[6];
+    uint8_t len;
+    /* events between two repeat points share a segment, */
+    /* and a run of writes never crosses into another one */
+    int segment;
+    int removed;
+};
+
+static struct event *events;
+static size_t num_events = 0;
+
+/* indices of the writes to one channel, reused for each pass */
+static size_t *writes;
+
+static size_t find_writes(uint8_t command)
+{
+    size_t i, count = 0;
+
+    for (i = 0; i < num_events; i++)
+    {
+        if (events[i].bytes[1] == command)
+            writes[count++] = i;
+    }
+
+    return count;
+}
+
+static unsigned int write_value(const struct event *e)
+{
+    if ((e->bytes[1] & 0xF0) == 0x00)
+        return e->bytes[2] | (e->bytes[3] << 8);
+
+    return e->bytes[2];
+}
+
+/* find how many writes after writes[i] continue at the same */
+/* period and by the same amount as the first two */
+static size_t run_steps(size_t i, size_t count, unsigned int mask,
+                        unsigned long *period, long *delta,
+                        long min_delta, long max_delta)
+{
+    const struct event *first = &events[writes[i]];
+    size_t steps = 0;
+
+    while (i + steps + 1 < count && steps < MAX_STEPS)
+    {
+        const struct event *a = &events[writes[i + steps]];
+        const struct event *b = &events[writes[i + steps + 1]];
+        unsigned long p = b->frame - a->frame;
+        long d = (long) ((write_value(b) - write_value(a)) & mask);
+
+        /* deltas are signed, and wrap like the channel's value does */
+        if (d > (long) (mask >> 1))
+            d -= (long) mask + 1;
+
+        if (b->segment != first->segment)
+            break;
+        if (!steps)
+        {
+            if (p < 1 || p > MAX_PERIOD || d < min_delta || d > max_delta)
+                break;
+            *period = p;
+            *delta = d;
+        }
+        else if (p != *period || d != *delta)
+        {
+            break;
+        }
+        steps++;
+    }
+
+    return steps;
+}
+
+/* replace runs of volume writes with envelopes */
+static void pack_envelopes(uint8_t channel)
+{
+    size_t count = find_writes(0x10 | channel);
+    size_t i = 0;
+
+    while (i < count)
+    {
+        struct event *e = &events[writes[i]];
+        unsigned long period = 0;
+        long delta = 0;
+        size_t steps, j;
+        int cut = 0;
+
+        steps = (e->bytes[2] <= 0x0F) ?
+                run_steps(i, count, 0xFF, &period, &delta, -8, 7) : 0;
+
+        /* a write of zero after the run becomes the length counter */
+        j = i + steps + 1;
+        if (e->bytes[2] <= 0x0F && j < count &&
+            events[writes[j]].bytes[2] == 0 &&
+            events[writes[j]].segment == e->segment &&
+            events[writes[j]].frame > e->frame &&
+            events[writes[j]].frame - e->frame <= MAX_LENGTH)
+        {
+            cut = 1;
+        }
+
+        /* a single write is smaller than an envelope */
+        if (!steps && !cut)
+        {
+            i++;
+            continue;
+        }
+
+        e->bytes[1] = (cut ? 0x60 : 0x50) | channel;
+        e->bytes[2] |= (delta & 0x0F) << 4;
+        e->bytes[3] = period | (steps << 4);
+        e->len = 4;
+        if (cut)
+        {
+            e->bytes[4] = events[writes[j]].frame - e->frame;
+            e->len = 5;
+        }
+
+        for (j = 1; j <= steps + cut; j++)
+            events[writes[i + j]].removed = 1;
+
+        i += steps + cut + 1;
+    }
+}
+
+/* replace runs of step writes with sweeps */
+static void pack_sweeps(uint8_t channel)
+{
+    size_t count = find_writes(0x00 | channel);
+    size_t i = 0;
+
+    while (i < count)
+    {
+        struct event *e = &events[writes[i]];
+        unsigned long period = 0;
+        long delta = 0;
+        size_t steps, j;
+
+        steps = run_steps(i, count, 0xFFFF, &period, &delta, -128, 127);
+        if (!steps)
+        {
+            i++;
+            continue;
+        }
+
+        e->bytes[1] = 0x70 | channel;
+        e->bytes[4] = delta & 0xFF;
+        e->bytes[5] = period | (steps << 4);
+        e->len = 6;
+
+        for (j = 1; j <= steps; j++)
+            events[writes[i + j]].removed = 1;
+
+        i += steps + 1;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t *data, *out;
+    size_t len, pos, out_len, i, kept;
+    unsigned long frame = 0, last, interval = 0, next_key;
+    int segment = 0;
+    uint8_t channel;
+    const char *path;
+    char comment[256];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'k':
+                interval = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+
+    if (optind != argc - 1)
+    {
+        fprintf(stderr, "usage: %s [-k frames] song.inc > song.env.inc\n"
+                "  -k frames  mark a keyframe point every this many frames\n",
+                argv[0]);
+        return 1;
+    }
+    path = argv[optind];
+
+    if (!(data = songfile_load(path, &len)))
+        return 1;
+
+    events = malloc((len / 2 + 1) * sizeof(struct event));
+    writes = malloc((len / 2 + 1) * sizeof(size_t));
+    if (!events || !writes)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    /* split the song into events, up to the jump to the repeat point */
+    for (pos = 0; pos + 1 < len;)
+    {
+        struct event *e = &events[num_events++];
+        uint8_t command = data[pos + 1];
+
+        memset(e, 0, sizeof(*e));
+        e->len = songfile_event_length(command);
+        if (pos + e->len > len)
+        {
+            fprintf(stderr, "%s: truncated event at byte %lu\n", path,
+                    (unsigned long) pos);
+            return 1;
+        }
+        memcpy(e->bytes, &data[pos], e->len);
+        pos += e->len;
+
+        switch (command & 0xF0)
+        {
+            case 0x00:
+            case 0x10:
+            case 0x30:
+            case 0x40:
+            case 0x80:
+                break;
+            /* a run may start again after the repeat point, */
+            /* so the units must not be running across it */
+            case 0xE0:
+            case 0xF0:
+                segment++;
+                break;
+            default:
+                fprintf(stderr, "%s: unexpected event 0x%02X at byte %lu\n",
+                        path, command, (unsigned long) (pos - e->len));
+                return 1;
+        }
+
+        frame += e->bytes[0];
+        e->frame = frame;
+        e->segment = segment;
+
+        if ((command & 0xF0) == 0xF0)
+            break;
+    }
+
+    /* without a jump the player would run off the end of the data, so */
+    /* loop the whole song instead, which must be done before packing */
+    /* since the last writes might be removed and the song shortened */
+    if (!num_events || (events[num_events - 1].bytes[1] & 0xF0) != 0xF0)
+    {
+        struct event *e = &events[num_events++];
+
+        fprintf(stderr, "%s: no jump to repeat point, looping whole song\n",
+                path);
+        memset(e, 0, sizeof(*e));
+        e->bytes[1] = 0xF0;
+        e->len = 2;
+        e->frame = frame;
+        e->segment = segment + 1;
+    }
+
+    for (channel = 0; channel < 4; channel++)
+    {
+        pack_envelopes(channel);
+        pack_sweeps(channel);
+    }
+
+    /* room for the remaining events and the keyframe points */
+    out = malloc(len + 2 + (interval ? 2 * (frame / interval + 1) : 0));
+    if (!out)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    /* the remaining events get new deltas */
+    out_len = 0;
+    kept = 0;
+    last = 0;
+    next_key = interval;
+    for (i = 0; i < num_events; i++)
+    {
+        struct event *e = &events[i];
+
+        if (e->removed)
+            continue;
+
+        /* a keyframe point goes just before the first event at or */
+        /* after each keyframe, with a zero delta so it doesn't */
+        /* change the timing of anything around it */
+        if (interval && e->frame >= next_key)
+        {
+            out[out_len++] = 0x00;
+            out[out_len++] = 0x20;
+            while (next_key <= e->frame)
+                next_key += interval;
+        }
+
+        if (e->frame - last > 0xFF)
+        {
+            fprintf(stderr, "%s: gap of more than 255 frames at frame %lu\n",
+                    path, e->frame);
+            return 1;
+        }
+        e->bytes[0] = e->frame - last;
+        last = e->frame;
+
+        memcpy(&out[out_len], e->bytes, e->len);
+        out_len += e->len;
+        kept++;
+    }
+
+    /* anything after the jump is copied as is */
+    memcpy(&out[out_len], &data[pos], len - pos);
+    out_len += len - pos;
+
+    fprintf(stderr, "%s: %lu -> %lu bytes, %lu -> %lu events\n", path,
+            (unsigned long) len, (unsigned long) out_len,
+            (unsigned long) num_events, (unsigned long) kept);
+
+    snprintf(comment, sizeof(comment),
+             "generated from %s by host/envpack, do not edit", path);
+    songfile_write(stdout, out, out_len, comment);
+
+    free(data);
+    free(events);
+    free(writes);
+    free(out);
+
+    return 0;
+}
@@ -0,0 +1,426 @@
+/* File:    golden.c
+   Author:  Frank Dischner
+   Purpose: Contains a host program which renders every song through the
+            synthesis core and compares the output against reference
+            hashes and levels kept in a file, to catch any change to the
+            output made by work on the core, or writes that file anew
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "platform.h"
+#include "synth.h"
+#include "songs.h"
+
+/* default to one minute of each song */
+#define DEFAULT_FRAMES (60 * 60)
+
+/* the output is compared in blocks of a second */
+#define BLOCK_FRAMES FRAME_RATE
+
+/* most songs and blocks per song in a reference file */
+#define MAX_SONGS  64
+#define MAX_BLOCKS 3600
+
+/* levels under a step are compared as a step, so that the */
+/* tolerance doesn't shrink to nothing on near silence */
+#define MIN_RMS 100
+
+/* output configuration, which references are only good for */
+#ifdef NES_MIXER
+#define CONFIG_MIXER "nes"
+#else
+#define CONFIG_MIXER "linear"
+#endif
+#if defined(DUAL_PWM)
+#define CONFIG_OUTPUT "dual"
+#elif defined(STEREO)
+#define CONFIG_OUTPUT "stereo"
+#else
+#define CONFIG_OUTPUT "mono"
+#endif
+#ifdef BLEP
+#define CONFIG_BLEP "blep"
+#else
+#define CONFIG_BLEP "plain"
+#endif
+
+/* what is kept of each second of output */
+struct block
+{
+    /* FNV-1a hash of the output bytes */
+    uint32_t hash;
+    /* root mean square of the samples about their mean, */
+    /* in 1/100ths of a step */
+    unsigned long rms;
+    /* number of times the output crosses its mean level in each */
+    /* frame, which roughly follows the pitch */
+    unsigned long crossings;
+};
+
+static struct block ref[MAX_SONGS][MAX_BLOCKS];
+static struct block out[MAX_BLOCKS];
+static unsigned long ref_blocks[MAX_SONGS];
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-t percent] references\n"
+            "       %s [-f frames] -w references\n"
+            "  -t percent  only fail where the level or number of\n"
+            "              crossings of a second of output differs by more\n"
+            "              than this much, instead of wherever it differs\n"
+            "  -f frames   number of frames of each song (default %d)\n"
+            "  -w          write new references instead of comparing\n",
+            prog, prog, DEFAULT_FRAMES);
+}
+
+static void print_name(FILE *f, uint32_t addr)
+{
+    char c;
+
+    while ((c = platform_read_byte(addr++)))
+        fputc(c, f);
+}
+
+/* the signed level of output sample i, with stereo mixed down */
+static long sample(const uint8_t *buf, uint16_t i)
+{
+#if defined(DUAL_PWM)
+    return ((buf[2 * i] << 8) | buf[2 * i + 1]) - 0x8000;
+#elif defined(STEREO)
+    return buf[2 * i] + buf[2 * i + 1] - 0x100;
+#else
+    return buf[i] - 0x80;
+#endif
+}
+
+/* render the current song from the start, keeping a block for */
+/* each second of it, and a last partial one */
+/* returns the number of blocks */
+static unsigned long render(unsigned long frames)
+{
+    static uint8_t buf[MAX_SAMPLES_PER_FRAME * SAMPLE_BYTES];
+    uint16_t frame_samples = synth_samples_per_frame();
+    unsigned long count = 0;
+    unsigned long i;
+    double sum = 0, squares = 0;
+    int below = 0;
+
+    synth_set_song(cur_song_data());
+    synth_set_keyframes(cur_song_keyframes());
+    synth_reset();
+
+    for (i = 0; i < frames; i++)
+    {
+        struct block *b = &out[count];
+        uint16_t j;
+
+        if (i % BLOCK_FRAMES == 0)
+        {
+            b->hash = 2166136261UL;
+            b->crossings = 0;
+            sum = squares = 0;
+        }
+
+        synth_process_events();
+        synth_render(buf, frame_samples);
+
+        for (j = 0; j < frame_samples * SAMPLE_BYTES; j++)
+        {
+            b->hash ^= buf[j];
+            b->hash *= 16777619UL;
+        }
+        {
+            /* the mean is taken out, so that mixers with different */
+            /* middle levels can be compared */
+            double frame_sum = 0, mean;
+
+            for (j = 0; j < frame_samples; j++)
+                frame_sum += sample(buf, j);
+            mean = frame_sum / frame_samples;
+
+            for (j = 0; j < frame_samples; j++)
+            {
+                long s = sample(buf, j);
+
+                squares += (double) s * s;
+                if ((s < mean) != below)
+                {
+                    b->crossings++;
+                    below = !below;
+                }
+            }
+            sum += frame_sum;
+        }
+
+        if (i % BLOCK_FRAMES == BLOCK_FRAMES - 1 || i == frames - 1)
+        {
+            double n = (i % BLOCK_FRAMES + 1) * frame_samples;
+            double variance = squares / n - (sum / n) * (sum / n);
+
+            b->rms = 100 * sqrt(variance > 0 ? variance : 0) + 0.5;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+/* how far off value is from expected, in percent */
+static unsigned long deviation(unsigned long value, unsigned long expected,
+                               unsigned long floor)
+{
+    unsigned long diff = (value > expected) ? value - expected :
+                                              expected - value;
+
+    if (expected < floor)
+        expected = floor;
+
+    return (diff * 100 + expected - 1) / expected;
+}
+
+static int write_references(const char *path, unsigned long frames)
+{
+    FILE *f;
+    uint8_t song;
+
+    if (frames < 1 || frames > (unsigned long) MAX_BLOCKS * BLOCK_FRAMES)
+    {
+        fprintf(stderr, "frames must be 1-%lu\n",
+                (unsigned long) MAX_BLOCKS * BLOCK_FRAMES);
+        return 1;
+    }
+
+    if (!(f = fopen(path, "w")))
+    {
+        perror(path);
+        return 1;
+    }
+
+    fprintf(f, "# output of every song, a line per second of hash, level "
+            "and crossings\n"
+            "# written by host/golden -w ('make golden'), do not edit\n");
+    fprintf(f, "config %s %s %s %u %u %lu\n", CONFIG_MIXER, CONFIG_OUTPUT,
+            CONFIG_BLEP, SAMPLE_RATE, FRAME_RATE, frames);
+
+    for (song = 0; song < num_songs(); song++)
+    {
+        unsigned long count = render(frames);
+        unsigned long i;
+
+        fprintf(f, "# ");
+        print_name(f, cur_song_name());
+        fprintf(f, "\nsong %u %lu\n", song, count);
+        for (i = 0; i < count; i++)
+            fprintf(f, "%08lX %lu %lu\n", (unsigned long) out[i].hash,
+                    out[i].rms, out[i].crossings);
+
+        next_song();
+    }
+
+    fclose(f);
+    fprintf(stderr, "%s: %u songs, %lu frames each\n", path, num_songs(),
+            frames);
+
+    return 0;
+}
+
+/* read the references, returning the number of frames rendered */
+/* for each song, or 0 if they can't be used */
+/* references for another mixer can be compared against with a */
+/* tolerance, but the output format and rates must match */
+static unsigned long read_references(const char *path, unsigned int *songs,
+                                     int tolerant)
+{
+    char line[256], mixer[16], output[16], blep[16];
+    unsigned long frames = 0, rate, fps, count = 0, i = 0;
+    unsigned int song = 0;
+    int have_song = 0;
+    FILE *f;
+
+    if (!(f = fopen(path, "r")))
+    {
+        perror(path);
+        return 0;
+    }
+
+    *songs = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        unsigned long hash, rms, crossings;
+
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+
+        if (sscanf(line, "config %15s %15s %15s %lu %lu %lu", mixer, output,
+                   blep, &rate, &fps, &frames) == 6)
+        {
+            if (strcmp(output, CONFIG_OUTPUT) || rate != SAMPLE_RATE ||
+                fps != FRAME_RATE || (!tolerant &&
+                (strcmp(mixer, CONFIG_MIXER) || strcmp(blep, CONFIG_BLEP))))
+            {
+                fprintf(stderr, "%s: references are for %s %s %s %lu %lu, "
+                        "but this build is %s %s %s %u %u\n", path, mixer,
+                        output, blep, rate, fps, CONFIG_MIXER, CONFIG_OUTPUT,
+                        CONFIG_BLEP, SAMPLE_RATE, FRAME_RATE);
+                fclose(f);
+                return 0;
+            }
+        }
+        else if (sscanf(line, "song %u %lu", &song, &count) == 2)
+        {
+            if (song >= MAX_SONGS || count > MAX_BLOCKS)
+                break;
+            ref_blocks[song] = count;
+            if (song + 1 > *songs)
+                *songs = song + 1;
+            have_song = 1;
+            i = 0;
+        }
+        else if (sscanf(line, "%lx %lu %lu", &hash, &rms, &crossings) == 3 &&
+                 have_song && i < count)
+        {
+            ref[song][i].hash = hash;
+            ref[song][i].rms = rms;
+            ref[song][i++].crossings = crossings;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (!feof(f) || !frames)
+    {
+        fprintf(stderr, "%s: not a reference file\n", path);
+        frames = 0;
+    }
+
+    fclose(f);
+
+    return frames;
+}
+
+/* compare every song against the references */
+/* returns the number of songs which don't match */
+static int compare(unsigned long frames, unsigned int songs,
+                   unsigned long tolerance, int tolerant)
+{
+    int failed = 0;
+    uint8_t song;
+
+    if (songs != num_songs())
+    {
+        fprintf(stderr, "%u songs, but the references have %u\n",
+                num_songs(), songs);
+        return 1;
+    }
+
+    for (song = 0; song < songs; song++)
+    {
+        unsigned long count = render(frames);
+        unsigned long i, differ = 0, first = 0, max_level = 0, max_cross = 0;
+        int bad = 0;
+
+        if (count != ref_blocks[song])
+        {
+            fprintf(stderr, "song %u: %lu seconds, but the references have "
+                    "%lu\n", song, count, ref_blocks[song]);
+            failed++;
+            next_song();
+            continue;
+        }
+
+        for (i = 0; i < count; i++)
+        {
+            unsigned long level, cross;
+
+            if (out[i].hash == ref[song][i].hash)
+                continue;
+
+            if (!differ++)
+                first = i;
+
+            level = deviation(out[i].rms, ref[song][i].rms, MIN_RMS);
+            cross = deviation(out[i].crossings, ref[song][i].crossings, 1);
+            if (level > max_level)
+                max_level = level;
+            if (cross > max_cross)
+                max_cross = cross;
+            if (!tolerant || level > tolerance || cross > tolerance)
+                bad = 1;
+        }
+
+        printf("%2u ", song);
+        print_name(stdout, cur_song_name());
+        if (!differ)
+            printf(": exact\n");
+        else
+            printf(": %s, %lu of %lu seconds differ from %lu:%02lu, level "
+                   "off by up to %lu%%, crossings by %lu%%\n",
+                   bad ? "FAILED" : "within tolerance", differ, count,
+                   first / 60, first % 60, max_level, max_cross);
+
+        failed += bad;
+        next_song();
+    }
+
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long frames = DEFAULT_FRAMES;
+    unsigned long tolerance = 0;
+    unsigned int songs;
+    int tolerant = 0;
+    int write = 0;
+    int failed;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:f:w")) != -1)
+    {
+        switch (opt)
+        {
+            case 't':
+                tolerance = strtoul(optarg, NULL, 0);
+                tolerant = 1;
+                break;
+            case 'f':
+                frames = strtoul(optarg, NULL, 0);
+                break;
+            case 'w':
+                write = 1;
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+
+    if (optind != argc - 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    songs_init();
+
+    if (write)
+        return write_references(argv[optind], frames);
+
+    if (!(frames = read_references(argv[optind], &songs, tolerant)))
+        return 1;
+
+    failed = compare(frames, songs, tolerance, tolerant);
+    if (failed)
+        fprintf(stderr, "%d of %u songs don't match %s\n", failed, songs,
+                argv[optind]);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,211 @@
+/* File:    lzpack.c
+   Author:  Frank Dischner
+   Purpose: Contains a host program which compresses a song .inc file into
+            the format read by the streaming decompressor (see lz.h)
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lz.h"
+#include "songfile.h"
+
+/* compressed output */
+static uint8_t *out;
+static size_t out_len = 0;
+
+/* the group currently being built */
+static uint8_t group[1 + 8 * 2];
+static size_t group_len = 0;
+static uint8_t group_tokens = 0;
+
+static void put_byte(uint8_t c)
+{
+    out[out_len++] = c;
+}
+
+static void flush_group(void)
+{
+    size_t i;
+
+    for (i = 0; i < group_len; i++)
+        put_byte(group[i]);
+
+    group_len = 0;
+    group_tokens = 0;
+}
+
+static void add_token(int literal, const uint8_t *bytes, size_t len)
+{
+    size_t i;
+
+    /* reserve the flag byte */
+    if (!group_tokens)
+    {
+        group[0] = 0;
+        group_len = 1;
+    }
+
+    if (literal)
+        group[0] |= 1 << group_tokens;
+    for (i = 0; i < len; i++)
+        group[group_len++] = bytes[i];
+
+    if (++group_tokens == 8)
+        flush_group();
+}
+
+/* find the longest match for data[pos] which doesn't reach back */
+/* before start, returning its length and setting dist */
+static size_t find_match(const uint8_t *data, size_t start, size_t end,
+                         size_t pos, size_t *dist)
+{
+    size_t best = 0;
+    size_t max = end - pos;
+    size_t from;
+
+    if (max > LZ_MAX_MATCH)
+        max = LZ_MAX_MATCH;
+
+    from = (pos - start > LZ_WINDOW_SIZE) ? pos - LZ_WINDOW_SIZE : start;
+    for (; from < pos; from++)
+    {
+        size_t len = 0;
+
+        while (len < max && data[from + len] == data[pos + len])
+            len++;
+
+        /* prefer the closest of equal matches */
+        if (len >= best)
+        {
+            best = len;
+            *dist = pos - from;
+        }
+    }
+
+    return best;
+}
+
+/* compress data[start..end), which must not depend on anything before it */
+static void compress_segment(const uint8_t *data, size_t start, size_t end)
+{
+    size_t pos = start;
+
+    while (pos < end)
+    {
+        size_t dist, next_dist;
+        size_t len = find_match(data, start, end, pos, &dist);
+
+        /* lazy matching: a literal is better if it leads to a longer match */
+        if (len >= LZ_MIN_MATCH && pos + 1 < end &&
+            find_match(data, start, end, pos + 1, &next_dist) > len)
+        {
+            len = 0;
+        }
+
+        if (len >= LZ_MIN_MATCH)
+        {
+            uint8_t token[2];
+
+            token[0] = (dist - 1) & 0xFF;
+            token[1] = ((dist - 1) >> 8) | ((len - LZ_MIN_MATCH) << 2);
+            add_token(0, token, 2);
+            pos += len;
+        }
+        else
+        {
+            add_token(1, &data[pos], 1);
+            pos++;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t *data;
+    size_t len, pos, start;
+    int has_jump = 0;
+    char comment[256];
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s song.inc > song.lz.inc\n", argv[0]);
+        return 1;
+    }
+
+    if (!(data = songfile_load(argv[1], &len)))
+        return 1;
+
+    /* anything after the jump to the repeat point is never played */
+    for (pos = 0; pos + 1 < len; pos += songfile_event_length(data[pos + 1]))
+    {
+        /* pattern events jump around in the song, which */
+        /* can't be done in the middle of a compressed stream */
+        if ((data[pos + 1] & 0xF0) >= 0xA0 && (data[pos + 1] & 0xF0) <= 0xD0)
+        {
+            fprintf(stderr, "%s: pattern events can't be compressed\n",
+                    argv[1]);
+            return 1;
+        }
+        if ((data[pos + 1] & 0xF0) == 0xF0)
+        {
+            len = pos + 2;
+            has_jump = 1;
+            break;
+        }
+    }
+
+    /* without a jump the player would run off the end of the data, */
+    /* so loop the whole song instead */
+    if (!has_jump)
+    {
+        fprintf(stderr, "%s: no jump to repeat point, looping whole song\n",
+                argv[1]);
+        if (!(data = realloc(data, len + 2)))
+        {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        data[len++] = 0x00;
+        data[len++] = 0xF0;
+    }
+
+    /* worst case is a flag byte for every eight literals */
+    out = malloc(len + len / 8 + 2);
+    if (!out)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    /* every repeat point and keyframe point starts a new segment, */
+    /* which can be decompressed without any of the data before it */
+    start = 0;
+    for (pos = 0; pos + 1 < len; pos += songfile_event_length(data[pos + 1]))
+    {
+        uint8_t class = data[pos + 1] & 0xF0;
+
+        if (class == 0xE0 || class == 0x20)
+        {
+            compress_segment(data, start, pos + 2);
+            flush_group();
+            start = pos + 2;
+        }
+    }
+    compress_segment(data, start, len);
+    flush_group();
+
+    fprintf(stderr, "%s: %lu -> %lu bytes\n", argv[1],
+            (unsigned long) len, (unsigned long) out_len);
+
+    snprintf(comment, sizeof(comment),
+             "generated from %s by host/lzpack, do not edit", argv[1]);
+    songfile_write(stdout, out, out_len, comment);
+
+    free(data);
+    free(out);
+
+    return 0;
+}
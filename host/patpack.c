@@ -0,0 +1,419 @@
+/* File:    patpack.c
+   Author:  Frank Dischner
+   Purpose: Contains a host program which shrinks a song .inc file by
+            factoring repeated runs of events out into patterns, which are
+            played with the call/return and loop events
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "songfile.h"
+
+/* sizes of the events used to play patterns */
+#define CALL_SIZE   4
+#define RETURN_SIZE 2
+#define LOOP_SIZE   3
+#define NEXT_SIZE   2
+
+/* longest pattern considered when looking for loops */
+#define MAX_LOOP_PERIOD 64
+
+/* an event, or a call to a pattern */
+struct token
+{
+    uint8_t bytes[6];
+    uint8_t len;
+    /* tokens with the same id are identical, except that control */
+    /* events get a unique id so they are never part of a pattern */
+    int id;
+    /* pattern index for calls, otherwise -1 */
+    int pattern;
+};
+
+struct stream
+{
+    struct token *tokens;
+    size_t count;
+};
+
+static struct stream song;
+static struct stream *patterns = NULL;
+static size_t num_patterns = 0;
+static int next_id = 0;
+
+static void *xmalloc(size_t size)
+{
+    void *p = malloc(size ? size : 1);
+
+    if (!p)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    return p;
+}
+
+/* give identical plain events the same id */
+static void assign_ids(struct token *tokens, size_t count)
+{
+    size_t i, j;
+
+    for (i = 0; i < count; i++)
+    {
+        uint8_t class = tokens[i].bytes[1] & 0xF0;
+
+        /* channel events are 0x00-0x80, except for keyframe points */
+        /* (0x20), which must not end up inside a pattern or a loop */
+        tokens[i].id = -1;
+        if (class > 0x80 || class == 0x20)
+        {
+            tokens[i].id = next_id++;
+            continue;
+        }
+
+        for (j = 0; j < i; j++)
+        {
+            if (tokens[j].pattern < 0 && tokens[j].len == tokens[i].len &&
+                !memcmp(tokens[j].bytes, tokens[i].bytes, tokens[i].len))
+            {
+                tokens[i].id = tokens[j].id;
+                break;
+            }
+        }
+        if (tokens[i].id < 0)
+            tokens[i].id = next_id++;
+    }
+}
+
+static size_t run_bytes(const struct token *t, size_t len)
+{
+    size_t bytes = 0;
+
+    while (len--)
+        bytes += (t++)->len;
+
+    return bytes;
+}
+
+static int run_equal(const struct token *a, const struct token *b, size_t len)
+{
+    while (len--)
+    {
+        if ((a++)->id != (b++)->id)
+            return 0;
+    }
+
+    return 1;
+}
+
+/* find the longest run of tokens which appears twice without overlapping */
+static size_t longest_repeat(const struct stream *s, size_t *start)
+{
+    uint16_t *prev = xmalloc((s->count + 2) * sizeof(uint16_t));
+    uint16_t *cur = xmalloc((s->count + 2) * sizeof(uint16_t));
+    size_t best_bytes = 0, best_len = 0;
+    size_t i, j;
+
+    memset(prev, 0, (s->count + 2) * sizeof(uint16_t));
+    memset(cur, 0, (s->count + 2) * sizeof(uint16_t));
+
+    /* cur[j] is the length of the common run starting at i and j */
+    for (i = s->count; i-- > 0;)
+    {
+        uint16_t *tmp;
+
+        for (j = s->count; j-- > i + 1;)
+        {
+            size_t len;
+
+            if (s->tokens[i].id != s->tokens[j].id ||
+                s->tokens[i].pattern >= 0)
+            {
+                cur[j] = 0;
+                continue;
+            }
+
+            cur[j] = prev[j + 1] + 1;
+            len = cur[j] < j - i ? cur[j] : j - i;
+            if (len >= 2 && len > best_len / 2)
+            {
+                size_t bytes = run_bytes(&s->tokens[i], len);
+
+                if (bytes > best_bytes)
+                {
+                    best_bytes = bytes;
+                    best_len = len;
+                    *start = i;
+                }
+            }
+        }
+        cur[s->count] = 0;
+
+        tmp = prev;
+        prev = cur;
+        cur = tmp;
+    }
+
+    free(prev);
+    free(cur);
+
+    return best_len;
+}
+
+/* replace every occurrence of a run with a call to a new pattern */
+static int factor_run(struct stream *s, size_t start, size_t len)
+{
+    struct token *run = xmalloc(len * sizeof(struct token));
+    size_t *found = xmalloc(s->count * sizeof(size_t));
+    size_t bytes = run_bytes(&s->tokens[start], len);
+    size_t count = 0, i, out;
+    long savings;
+    struct token call;
+
+    memcpy(run, &s->tokens[start], len * sizeof(struct token));
+
+    for (i = 0; i + len <= s->count;)
+    {
+        if (run_equal(&s->tokens[i], run, len))
+        {
+            found[count++] = i;
+            i += len;
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    savings = (long) (count * bytes) -
+              (long) (count * CALL_SIZE + bytes + RETURN_SIZE);
+    if (savings <= 0)
+    {
+        free(run);
+        free(found);
+        return 0;
+    }
+
+    patterns = realloc(patterns, (num_patterns + 1) * sizeof(struct stream));
+    if (!patterns)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    patterns[num_patterns].tokens = run;
+    patterns[num_patterns].count = len;
+
+    /* a call is a zero delta event, since the pattern's */
+    /* first event carries the delta of the original run */
+    memset(&call, 0, sizeof(call));
+    call.bytes[1] = 0xC0;
+    call.len = CALL_SIZE;
+    call.id = next_id++;
+    call.pattern = num_patterns++;
+
+    for (i = 0, out = 0; i < count; i++)
+    {
+        size_t from = i ? found[i - 1] + len : 0;
+
+        memmove(&s->tokens[out], &s->tokens[from],
+                (found[i] - from) * sizeof(struct token));
+        out += found[i] - from;
+        s->tokens[out++] = call;
+    }
+    memmove(&s->tokens[out], &s->tokens[found[count - 1] + len],
+            (s->count - found[count - 1] - len) * sizeof(struct token));
+    out += s->count - found[count - 1] - len;
+    s->count = out;
+
+    free(found);
+
+    return 1;
+}
+
+/* collapse back to back repeats of a run into a loop */
+static size_t write_loops(struct token *out, const struct stream *s)
+{
+    size_t i = 0, n = 0;
+
+    while (i < s->count)
+    {
+        size_t best_period = 0, best_reps = 0;
+        long best_savings = 0;
+        size_t period;
+
+        for (period = 1; period <= MAX_LOOP_PERIOD &&
+             i + 2 * period <= s->count; period++)
+        {
+            size_t reps = 1;
+            long savings;
+
+            while (reps < 255 && i + (reps + 1) * period <= s->count &&
+                   run_equal(&s->tokens[i], &s->tokens[i + reps * period],
+                             period))
+            {
+                reps++;
+            }
+
+            savings = (long) ((reps - 1) * run_bytes(&s->tokens[i], period)) -
+                      (LOOP_SIZE + NEXT_SIZE);
+            if (reps > 1 && savings > best_savings)
+            {
+                best_savings = savings;
+                best_period = period;
+                best_reps = reps;
+            }
+        }
+
+        if (!best_period)
+        {
+            out[n++] = s->tokens[i++];
+            continue;
+        }
+
+        /* loop start with its count, then the body, then the loop end */
+        memset(&out[n], 0, sizeof(struct token));
+        out[n].bytes[1] = 0xA0;
+        out[n].bytes[2] = best_reps;
+        out[n].len = LOOP_SIZE;
+        out[n++].pattern = -1;
+        memcpy(&out[n], &s->tokens[i], best_period * sizeof(struct token));
+        n += best_period;
+        memset(&out[n], 0, sizeof(struct token));
+        out[n].bytes[1] = 0xB0;
+        out[n].len = NEXT_SIZE;
+        out[n++].pattern = -1;
+
+        i += best_period * best_reps;
+    }
+
+    return n;
+}
+
+static size_t emit(uint8_t *data, size_t pos, const struct token *t,
+                   size_t count, const size_t *offsets)
+{
+    while (count--)
+    {
+        memcpy(&data[pos], t->bytes, t->len);
+        /* calls hold the pattern's offset from the start of the song */
+        if (t->pattern >= 0)
+        {
+            data[pos + 2] = offsets[t->pattern] & 0xFF;
+            data[pos + 3] = offsets[t->pattern] >> 8;
+        }
+        pos += t->len;
+        t++;
+    }
+
+    return pos;
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t *data, *out;
+    size_t len, pos, i, start, run, main_count, size;
+    struct token *looped;
+    size_t *offsets;
+    char comment[256];
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s song.inc > song.pat.inc\n", argv[0]);
+        return 1;
+    }
+
+    if (!(data = songfile_load(argv[1], &len)))
+        return 1;
+
+    /* split the song into events, ending at the jump to the repeat point */
+    song.tokens = xmalloc((len / 2 + 1) * sizeof(struct token));
+    song.count = 0;
+    for (pos = 0; pos + 1 < len;)
+    {
+        struct token *t = &song.tokens[song.count++];
+        uint8_t command = data[pos + 1];
+
+        memset(t, 0, sizeof(*t));
+        t->len = songfile_event_length(command);
+        t->pattern = -1;
+        if (pos + t->len > len)
+        {
+            fprintf(stderr, "%s: truncated event at byte %lu\n", argv[1],
+                    (unsigned long) pos);
+            return 1;
+        }
+        memcpy(t->bytes, &data[pos], t->len);
+        pos += t->len;
+
+        if ((command & 0xF0) == 0xF0)
+            break;
+        if ((command & 0xF0) >= 0xA0 && (command & 0xF0) <= 0xD0)
+        {
+            fprintf(stderr, "%s: already contains pattern events\n", argv[1]);
+            return 1;
+        }
+    }
+
+    /* without a jump the player would run off the end of the data, */
+    /* so loop the whole song instead */
+    if (!song.count || (song.tokens[song.count - 1].bytes[1] & 0xF0) != 0xF0)
+    {
+        struct token *t = &song.tokens[song.count++];
+
+        fprintf(stderr, "%s: no jump to repeat point, looping whole song\n",
+                argv[1]);
+        memset(t, 0, sizeof(*t));
+        t->bytes[1] = 0xF0;
+        t->len = 2;
+        t->pattern = -1;
+    }
+
+    assign_ids(song.tokens, song.count);
+
+    /* factor out the longest repeated run until it no longer pays off */
+    while ((run = longest_repeat(&song, &start)) &&
+           factor_run(&song, start, run))
+        ;
+
+    /* then turn back to back repeats into loops */
+    looped = xmalloc(song.count * 2 * sizeof(struct token));
+    main_count = write_loops(looped, &song);
+
+    /* patterns follow the main stream, which ends with the jump, */
+    /* so they are only ever reached by a call */
+    offsets = xmalloc((num_patterns + 1) * sizeof(size_t));
+    size = run_bytes(looped, main_count);
+    for (i = 0; i < num_patterns; i++)
+    {
+        offsets[i] = size;
+        size += run_bytes(patterns[i].tokens, patterns[i].count) + RETURN_SIZE;
+    }
+    if (size > 0xFFFF)
+    {
+        fprintf(stderr, "%s: too large for 16-bit pattern offsets\n", argv[1]);
+        return 1;
+    }
+
+    out = xmalloc(size);
+    pos = emit(out, 0, looped, main_count, offsets);
+    for (i = 0; i < num_patterns; i++)
+    {
+        pos = emit(out, pos, patterns[i].tokens, patterns[i].count, offsets);
+        out[pos++] = 0x00;
+        out[pos++] = 0xD0;
+    }
+
+    fprintf(stderr, "%s: %lu -> %lu bytes, %lu patterns\n", argv[1],
+            (unsigned long) len, (unsigned long) size,
+            (unsigned long) num_patterns);
+
+    snprintf(comment, sizeof(comment),
+             "generated from %s by host/patpack, do not edit", argv[1]);
+    songfile_write(stdout, out, size, comment);
+
+    return 0;
+}
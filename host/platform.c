@@ -0,0 +1,65 @@
+/* File:    platform.c
+   Author:  Frank Dischner
+   Purpose: Contains the host implementation of the platform routines, which
+            map the 32-bit 'pointers' used by the synthesis core onto
+            regular memory
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "platform.h"
+
+/* the top bit of an address is left free for flags like SONG_COMPRESSED */
+#define MAX_REGIONS 127
+
+struct region
+{
+    const uint8_t *data;
+    uint32_t size;
+};
+
+static struct region regions[MAX_REGIONS];
+static unsigned int num_regions = 0;
+
+uint32_t platform_register(const void *data, uint32_t size)
+{
+    unsigned int i;
+
+    /* registering the same data twice gives the same address */
+    for (i = 0; i < num_regions; i++)
+    {
+        if (regions[i].data == data)
+            return (uint32_t) (i + 1) << 24;
+    }
+
+    if (num_regions == MAX_REGIONS)
+    {
+        fprintf(stderr, "platform: too many data regions\n");
+        exit(1);
+    }
+
+    regions[num_regions].data = data;
+    regions[num_regions].size = size;
+    num_regions++;
+
+    /* region 0 is never used, so a valid address is never zero */
+    return (uint32_t) num_regions << 24;
+}
+
+uint8_t platform_read_byte(uint32_t addr)
+{
+    uint32_t idx = (addr >> 24) - 1;
+    uint32_t offset = addr & 0xFFFFFF;
+
+    /* the AVR would happily read past the end of the data, but */
+    /* on the host that is always a bug in the song or the decoder */
+    if (idx >= num_regions || offset >= regions[idx].size)
+    {
+        fprintf(stderr, "platform: read from invalid address 0x%08lx\n",
+                (unsigned long) addr);
+        abort();
+    }
+
+    return regions[idx].data[offset];
+}
@@ -0,0 +1,218 @@
+/* File:    render.c
+   Author:  Frank Dischner
+   Purpose: Contains a host program which runs the synthesis core on a song,
+            optionally writing the output to a WAV or raw PCM file, and
+            reports how fast the core runs
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "platform.h"
+#include "synth.h"
+#include "songs.h"
+#include "sfx.h"
+#include "wavfile.h"
+
+/* default to one minute of audio */
+#define DEFAULT_FRAMES (60 * 60)
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-l] [-s song] [-t frame] [-f frames] [-x speed]\n"
+            "          [-a rate] [-p] [-e effect:frame] [-r] [-o file]\n"
+            "  -l         list songs and exit\n"
+            "  -s song    song index to render (default 0)\n"
+            "  -t frame   seek to this frame first, using the seek index\n"
+            "  -f frames  number of frames to render (default %d)\n"
+            "  -x speed   fast forward, skipping all but one of every speed\n"
+            "             frames (the frame count is of rendered frames)\n"
+            "  -a rate    output sample rate, %d-%d (default %d)\n"
+            "  -p         play at the PAL frame rate of %d fps instead of %d\n"
+            "  -e effect:frame\n"
+            "             play a sound effect from this rendered frame on\n"
+            "  -r         write raw %s PCM instead of WAV\n"
+            "  -o file    output file, '-' for stdout (default: none)\n",
+            prog, DEFAULT_FRAMES, MIN_SAMPLE_RATE, MAX_SAMPLE_RATE,
+            SAMPLE_RATE, FRAME_RATE_PAL, FRAME_RATE_NTSC,
+            PCM_FORMAT);
+}
+
+static void print_name(FILE *f, uint32_t addr)
+{
+    char c;
+
+    while ((c = platform_read_byte(addr++)))
+        fputc(c, f);
+}
+
+static double elapsed_ns(const struct timespec *start,
+                         const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e9 +
+           (end->tv_nsec - start->tv_nsec);
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t buf[MAX_SAMPLES_PER_FRAME * SAMPLE_BYTES];
+    struct timespec start, end;
+    unsigned long frames = DEFAULT_FRAMES;
+    unsigned long seek = 0;
+    unsigned long speed = 1;
+    unsigned long rate = SAMPLE_RATE;
+    unsigned long fps = FRAME_RATE;
+    uint16_t frame_samples;
+    unsigned long i;
+    const char *outname = NULL;
+    FILE *out = NULL;
+    int song = 0;
+    int effect = -1;
+    unsigned long effect_frame = 0;
+    int raw = 0;
+    int list = 0;
+    double ns, samples;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ls:t:f:x:a:pe:ro:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l':
+                list = 1;
+                break;
+            case 's':
+                song = atoi(optarg);
+                break;
+            case 't':
+                seek = strtoul(optarg, NULL, 0);
+                break;
+            case 'f':
+                frames = strtoul(optarg, NULL, 0);
+                break;
+            case 'x':
+                speed = strtoul(optarg, NULL, 0);
+                break;
+            case 'a':
+                rate = strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                fps = FRAME_RATE_PAL;
+                break;
+            case 'e':
+                if (sscanf(optarg, "%d:%lu", &effect, &effect_frame) < 1 ||
+                    effect < 0 || effect >= NUM_SFX)
+                {
+                    fprintf(stderr, "invalid sound effect %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'r':
+                raw = 1;
+                break;
+            case 'o':
+                outname = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    songs_init();
+    sfx_init();
+
+    if (list)
+    {
+        for (i = 0; i < num_songs(); i++)
+        {
+            printf("%lu: ", i);
+            print_name(stdout, cur_song_name());
+            printf("\n");
+            next_song();
+        }
+        return 0;
+    }
+
+    if (song < 0 || song >= num_songs())
+    {
+        fprintf(stderr, "invalid song index %d\n", song);
+        return 1;
+    }
+
+    if (rate < MIN_SAMPLE_RATE || rate > MAX_SAMPLE_RATE)
+    {
+        fprintf(stderr, "sample rate must be %d-%d\n", MIN_SAMPLE_RATE,
+                MAX_SAMPLE_RATE);
+        return 1;
+    }
+    synth_set_rate(rate, fps);
+    frame_samples = synth_samples_per_frame();
+
+    /* select the requested song */
+    while (song--)
+        next_song();
+
+    if (outname)
+    {
+        out = strcmp(outname, "-") ? fopen(outname, "wb") : stdout;
+        if (!out)
+        {
+            perror(outname);
+            return 1;
+        }
+        if (!raw)
+            wavfile_write_header(out, frames * frame_samples, rate);
+    }
+
+    synth_set_song(cur_song_data());
+    synth_set_keyframes(cur_song_keyframes());
+    synth_reset();
+
+    if (seek && synth_seek(seek) != seek)
+    {
+        fprintf(stderr, "seeking to frame %lu needs too long a replay\n",
+                seek);
+        return 1;
+    }
+
+    /* only the synthesis is timed, not writing the output */
+    ns = 0;
+    for (i = 0; i < frames; i++)
+    {
+        unsigned long j;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (effect >= 0 && i == effect_frame)
+            synth_play_sfx(sfx_data(effect));
+        for (j = 1; j < speed; j++)
+            synth_skip_frame();
+        synth_process_events();
+        synth_render(buf, frame_samples);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        ns += elapsed_ns(&start, &end);
+
+        if (out)
+        {
+            wavfile_to_pcm(buf, frame_samples);
+            fwrite(buf, SAMPLE_BYTES, frame_samples, out);
+        }
+    }
+
+    if (out && out != stdout)
+        fclose(out);
+
+    samples = (double) frames * frame_samples;
+    print_name(stderr, cur_song_name());
+    fprintf(stderr, "\n%lu frames, %.0f samples in %.3f ms\n",
+            frames, samples, ns / 1e6);
+    fprintf(stderr, "%.0f frames/sec, %.2f ns/sample, %.1fx real time\n",
+            frames / (ns / 1e9), ns / samples,
+            (samples / rate) / (ns / 1e9));
+
+    return 0;
+}
@@ -0,0 +1,142 @@
+/* File:    seekgen.c
+   Author:  Frank Dischner
+   Purpose: Contains a host program which plays a packed song through the
+            synthesis core and writes its seek index, a keyframe of the
+            core's state at each keyframe point (see synth.h)
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "platform.h"
+#include "synth.h"
+#include "songfile.h"
+
+/* the index has a count byte */
+#define MAX_KEYFRAMES 255
+/* offsets of the frame and decoder position within a keyframe */
+#define KEYFRAME_FRAME 0
+#define KEYFRAME_POS   4
+
+static uint8_t seek_index[SYNTH_SEEK_HEADER_SIZE +
+                          MAX_KEYFRAMES * SYNTH_KEYFRAME_SIZE];
+static uint8_t count = 0;
+
+static uint8_t *keyframe(uint8_t i)
+{
+    return &seek_index[SYNTH_SEEK_HEADER_SIZE + i * SYNTH_KEYFRAME_SIZE];
+}
+
+static uint16_t get_word(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+/* find the first keyframe with the same decoder position as k */
+/* returns -1 if there is none */
+static int find(const uint8_t *k)
+{
+    uint8_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (get_word(keyframe(i) + KEYFRAME_POS) == get_word(k + KEYFRAME_POS))
+            return i;
+    }
+
+    return -1;
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t buf[MAX_SAMPLES_PER_FRAME * SAMPLE_BYTES];
+    uint8_t *data;
+    size_t len;
+    uint32_t addr, flags = 0;
+    unsigned long frame;
+    uint8_t loop = 0;
+    uint16_t loop_frames = 0;
+    const char *path;
+    char comment[256];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "z")) != -1)
+    {
+        switch (opt)
+        {
+            case 'z':
+                flags = SONG_COMPRESSED;
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+
+    if (optind != argc - 1)
+    {
+        fprintf(stderr, "usage: %s [-z] song.inc > song.seek.inc\n"
+                "  -z  song data is compressed\n", argv[0]);
+        return 1;
+    }
+    path = argv[optind];
+
+    if (!(data = songfile_load(path, &len)))
+        return 1;
+
+    addr = platform_register(data, len);
+    synth_set_song(addr | flags);
+    synth_reset();
+
+    /* The output is rendered as usual, since the phases and lfsr in a */
+    /* keyframe have to match what playback at the default rate would */
+    /* have reached (see synth.h). The first pass through the song is */
+    /* recorded, then the second pass through its looping part, since */
+    /* that can start out with state left over from the end of the */
+    /* song instead of its beginning. */
+    for (frame = 0; frame < 0xFFFF && count < MAX_KEYFRAMES; frame++)
+    {
+        uint8_t *k = keyframe(count);
+        int i;
+
+        synth_process_events();
+        synth_render(buf, synth_samples_per_frame());
+
+        if (!synth_save_keyframe(k))
+            continue;
+
+        /* the second pass ends where it started */
+        if (loop && get_word(k + KEYFRAME_POS) ==
+                    get_word(keyframe(loop) + KEYFRAME_POS))
+            break;
+
+        i = find(k);
+        if (!loop && i >= 0)
+        {
+            loop = count;
+            loop_frames = get_word(k + KEYFRAME_FRAME) -
+                          get_word(keyframe(i) + KEYFRAME_FRAME);
+        }
+        count++;
+    }
+
+    seek_index[0] = count;
+    seek_index[1] = loop;
+    seek_index[2] = loop_frames & 0xFF;
+    seek_index[3] = loop_frames >> 8;
+
+    fprintf(stderr, "%s: %u keyframes, looping every %u frames\n", path,
+            count, loop_frames);
+
+    snprintf(comment, sizeof(comment),
+             "generated from %s by host/seekgen, do not edit", path);
+    songfile_write(stdout, seek_index,
+                   SYNTH_SEEK_HEADER_SIZE + count * SYNTH_KEYFRAME_SIZE,
+                   comment);
+
+    free(data);
+
+    return 0;
+}
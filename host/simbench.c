@@ -0,0 +1,290 @@
+/* File:    simbench.c
+   Author:  Frank Dischner
+   Purpose: Contains a host program which runs the benchmark firmware under
+            simavr and reports the cycles spent per frame in event decoding,
+            sample calculation and the sample output interrupt
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libelf.h>
+#include <gelf.h>
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include "synth.h"
+#include "bench.h"
+
+#ifndef F_CPU
+#define F_CPU 20000000
+#endif
+
+/* cycles available for each frame */
+#define FRAME_BUDGET ((uint64_t) F_CPU * SAMPLES_PER_FRAME / SAMPLE_RATE)
+
+/* data space address of GPIOR0, where the firmware writes markers */
+#define GPIOR0_ADDR 0x3E
+
+/* TIMER1_COMPA on the atmega1284p */
+#define SAMPLE_VECTOR 13
+
+/* give up if the firmware never finishes */
+#define MAX_CYCLES ((uint64_t) F_CPU * 60 * 60)
+
+struct cycle_stat
+{
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+};
+
+enum
+{
+    STAT_DECODE = 0,
+    STAT_RENDER,
+    STAT_ISR,
+    STAT_TOTAL,
+    NUM_STATS
+};
+
+static const char *stat_names[NUM_STATS] =
+{
+    "decode", "render", "isr", "total"
+};
+
+/* address range of the sample interrupt, including its vector */
+static uint32_t isr_start, isr_end, isr_vector;
+/* cycles spent in the sample interrupt so far */
+static uint64_t isr_cycles = 0;
+
+/* per frame measurements */
+static int in_frame = 0;
+static uint64_t frame_start, frame_isr_start;
+static uint64_t render_start, render_isr_start;
+static uint64_t decode, render;
+
+/* per song statistics */
+static int song = -1;
+static unsigned long frames = 0;
+static struct cycle_stat stats[NUM_STATS];
+static uint64_t worst = 0;
+static int done = 0;
+
+static int find_symbol(const char *path, const char *name,
+                       uint32_t *addr, uint32_t *size)
+{
+    Elf *e;
+    Elf_Scn *scn = NULL;
+    int fd, found = 0;
+
+    if (elf_version(EV_CURRENT) == EV_NONE)
+        return 0;
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return 0;
+    if (!(e = elf_begin(fd, ELF_C_READ, NULL)))
+    {
+        close(fd);
+        return 0;
+    }
+
+    while (!found && (scn = elf_nextscn(e, scn)))
+    {
+        GElf_Shdr shdr;
+        Elf_Data *data;
+        size_t i, count;
+
+        if (!gelf_getshdr(scn, &shdr) || shdr.sh_type != SHT_SYMTAB)
+            continue;
+
+        data = elf_getdata(scn, NULL);
+        count = shdr.sh_size / shdr.sh_entsize;
+        for (i = 0; i < count; i++)
+        {
+            GElf_Sym sym;
+            const char *s;
+
+            if (!gelf_getsym(data, i, &sym))
+                continue;
+            s = elf_strptr(e, shdr.sh_link, sym.st_name);
+            if (s && !strcmp(s, name))
+            {
+                *addr = sym.st_value;
+                *size = sym.st_size;
+                found = 1;
+                break;
+            }
+        }
+    }
+
+    elf_end(e);
+    close(fd);
+
+    return found;
+}
+
+static void stat_add(struct cycle_stat *s, uint64_t value)
+{
+    if (!frames || value < s->min)
+        s->min = value;
+    if (value > s->max)
+        s->max = value;
+    s->sum += value;
+}
+
+static void finish_frame(void)
+{
+    uint64_t isr = isr_cycles - frame_isr_start;
+
+    stat_add(&stats[STAT_DECODE], decode);
+    stat_add(&stats[STAT_RENDER], render);
+    stat_add(&stats[STAT_ISR], isr);
+    stat_add(&stats[STAT_TOTAL], decode + render + isr);
+    frames++;
+
+    in_frame = 0;
+}
+
+static void finish_song(void)
+{
+    int i;
+
+    if (song < 0 || !frames)
+        return;
+
+    printf("song %d: %lu frames\n", song, frames);
+    for (i = 0; i < NUM_STATS; i++)
+    {
+        printf("  %-6s min %7llu  mean %7llu  max %7llu  (%5.1f%% of budget)\n",
+               stat_names[i],
+               (unsigned long long) stats[i].min,
+               (unsigned long long) (stats[i].sum / frames),
+               (unsigned long long) stats[i].max,
+               100.0 * stats[i].max / FRAME_BUDGET);
+    }
+
+    if (stats[STAT_TOTAL].max > worst)
+        worst = stats[STAT_TOTAL].max;
+
+    memset(stats, 0, sizeof(stats));
+    frames = 0;
+}
+
+static void marker_write(avr_t *avr, avr_io_addr_t addr, uint8_t v,
+                         void *param)
+{
+    uint64_t now = avr->cycle;
+
+    (void) param;
+    avr->data[addr] = v;
+
+    switch (v)
+    {
+        case BENCH_FRAME_START:
+            if (in_frame)
+                finish_frame();
+            in_frame = 1;
+            frame_start = now;
+            frame_isr_start = isr_cycles;
+            decode = render = 0;
+            break;
+        case BENCH_DECODE_END:
+            decode = (now - frame_start) - (isr_cycles - frame_isr_start);
+            break;
+        /* a frame may be rendered in several pieces */
+        case BENCH_RENDER_START:
+            render_start = now;
+            render_isr_start = isr_cycles;
+            break;
+        case BENCH_RENDER_END:
+            render += (now - render_start) - (isr_cycles - render_isr_start);
+            break;
+        default:
+            /* a new song (or the end) cuts the last frame short, */
+            /* so it is dropped rather than skewing the minimums */
+            in_frame = 0;
+            finish_song();
+            if (v == BENCH_DONE)
+                done = 1;
+            else
+                song = v & ~BENCH_SONG;
+            break;
+    }
+}
+
+static int in_isr(uint32_t pc)
+{
+    return (pc >= isr_start && pc < isr_end) ||
+           (pc >= isr_vector && pc < isr_vector + 4);
+}
+
+int main(int argc, char **argv)
+{
+    elf_firmware_t fw;
+    avr_t *avr;
+    uint32_t size;
+    char name[16];
+    int state;
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s bench.elf\n", argv[0]);
+        return 1;
+    }
+
+    snprintf(name, sizeof(name), "__vector_%d", SAMPLE_VECTOR);
+    if (!find_symbol(argv[1], name, &isr_start, &size))
+    {
+        fprintf(stderr, "%s: no %s symbol\n", argv[1], name);
+        return 1;
+    }
+    isr_end = isr_start + size;
+    isr_vector = SAMPLE_VECTOR * 4;
+
+    memset(&fw, 0, sizeof(fw));
+    if (elf_read_firmware(argv[1], &fw))
+    {
+        fprintf(stderr, "%s: unable to load firmware\n", argv[1]);
+        return 1;
+    }
+    fw.frequency = F_CPU;
+
+    if (!(avr = avr_make_mcu_by_name("atmega1284p")))
+    {
+        fprintf(stderr, "simavr does not support the atmega1284p\n");
+        return 1;
+    }
+    avr_init(avr);
+    avr_load_firmware(avr, &fw);
+    avr_register_io_write(avr, GPIOR0_ADDR, marker_write, NULL);
+
+    printf("frame budget: %llu cycles\n", (unsigned long long) FRAME_BUDGET);
+
+    do
+    {
+        uint64_t cycle = avr->cycle;
+        uint32_t pc = avr->pc;
+
+        state = avr_run(avr);
+
+        /* a step which enters the interrupt is also counted, */
+        /* as it includes the cycles needed to service it */
+        if (in_isr(pc) || in_isr(avr->pc))
+            isr_cycles += avr->cycle - cycle;
+    } while (!done && state != cpu_Done && state != cpu_Crashed &&
+             avr->cycle < MAX_CYCLES);
+
+    if (!done)
+    {
+        fprintf(stderr, "firmware did not finish\n");
+        return 1;
+    }
+
+    printf("worst frame: %llu cycles (%.1f%% of budget)\n",
+           (unsigned long long) worst, 100.0 * worst / FRAME_BUDGET);
+
+    /* fail if any frame could have caused an underrun */
+    return worst > FRAME_BUDGET;
+}
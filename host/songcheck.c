@@ -0,0 +1,471 @@
+/* File:    songcheck.c
+   Author:  Frank Dischner
+   Purpose: Contains a host program which checks a packed song .inc file by
+            walking its events the way the synthesis core decodes them, and
+            reports how many events each frame has, the length of the song
+            and its loop, and an estimate of the worst frame's cost, so that
+            broken songs and songs which can't be played in time are caught
+            when building
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "synth.h"
+#include "songfile.h"
+
+#ifndef F_CPU
+#define F_CPU 20000000UL
+#endif
+
+/* nesting of loops and pattern calls the core keeps track of */
+/* (see synth.c) */
+#define PATTERN_DEPTH 4
+
+/* a song which decodes this many events without reaching its */
+/* jump to the repeat point is taken to never reach it */
+#define MAX_EVENTS 1000000UL
+
+/* frames are counted in 16 bits by the core */
+#define MAX_FRAMES 0x10000UL
+
+/* frames with this many events or more share the last histogram row */
+#define HISTOGRAM_SIZE 16
+
+/* Rough costs in CPU cycles, for estimating the worst frame. They are
+   ballpark figures for the linear mixer built with -Os, and 'make bench'
+   measures the real ones under a simulator; the render cost can be
+   given with -r for other builds. Every event is counted as decoded in
+   the frame it belongs to, as happens when the event queue runs dry,
+   though usually most of them are decoded ahead while waiting. */
+#define FRAME_CYCLES   400
+#define EVENT_CYCLES   150
+#define CONTROL_CYCLES 100
+/* extra for each byte read from compressed data (-z) */
+#define LZ_BYTE_CYCLES 40
+/* rendering one sample of all channels */
+#define SAMPLE_CYCLES  160
+
+struct level
+{
+    /* where a loop starts again or a call returns to */
+    size_t pos;
+    /* loop count, or 0 for a call */
+    unsigned int count;
+};
+
+/* envelope of a channel, stepped like the core's */
+struct unit
+{
+    int delta;
+    unsigned int period;
+    unsigned int timer;
+    unsigned int steps;
+};
+
+static const char *path;
+static int errors = 0;
+
+static int volume[4];
+static struct unit envelope[4];
+static unsigned int length[4];
+/* the first frame each channel's volume went out of range */
+static long bad_volume[4] = { -1, -1, -1, -1 };
+
+/* counts for the frame being walked */
+static unsigned long frame = 0;
+static unsigned int frame_events = 0;
+static unsigned int frame_controls = 0;
+static unsigned long frame_bytes = 0;
+
+/* counts for the whole song */
+static unsigned long histogram[HISTOGRAM_SIZE];
+static unsigned int max_events = 0;
+static unsigned long max_events_frame = 0;
+static unsigned long max_cycles = 0;
+static unsigned long max_cycles_frame = 0;
+
+static unsigned long cycles_per_sample = SAMPLE_CYCLES;
+static unsigned long byte_cycles = 0;
+static uint16_t samples_per_frame;
+
+static void error(size_t pos, const char *msg, unsigned int value)
+{
+    fprintf(stderr, "%s: ", path);
+    fprintf(stderr, msg, value);
+    fprintf(stderr, " at byte %lu (frame %lu)\n", (unsigned long) pos, frame);
+    errors++;
+}
+
+/* step the envelopes and length counters as the core does at the */
+/* start of each frame */
+static void clock_units(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < 4; i++)
+    {
+        struct unit *u = &envelope[i];
+
+        if (u->steps && !--u->timer)
+        {
+            u->timer = u->period;
+            u->steps--;
+            volume[i] += u->delta;
+        }
+        if (length[i] && !--length[i])
+        {
+            volume[i] = 0;
+            u->steps = 0;
+        }
+    }
+}
+
+/* finish the frame being walked and start the next one */
+static void next_frame(void)
+{
+    unsigned long cycles;
+    uint8_t i;
+
+    /* the mixer only covers volumes 0-15 */
+    for (i = 0; i < 4; i++)
+    {
+        if ((volume[i] < 0 || volume[i] > 15) && bad_volume[i] < 0)
+        {
+            fprintf(stderr, "%s: channel %u volume %d out of range "
+                    "at frame %lu\n", path, i, volume[i], frame);
+            bad_volume[i] = frame;
+            errors++;
+        }
+    }
+
+    histogram[(frame_events < HISTOGRAM_SIZE) ?
+              frame_events : HISTOGRAM_SIZE - 1]++;
+    if (frame_events > max_events)
+    {
+        max_events = frame_events;
+        max_events_frame = frame;
+    }
+
+    cycles = FRAME_CYCLES + frame_events * EVENT_CYCLES +
+             frame_controls * CONTROL_CYCLES + frame_bytes * byte_cycles +
+             samples_per_frame * cycles_per_sample;
+    if (cycles > max_cycles)
+    {
+        max_cycles = cycles;
+        max_cycles_frame = frame;
+    }
+
+    frame++;
+    frame_events = frame_controls = 0;
+    frame_bytes = 0;
+
+    clock_units();
+}
+
+/* apply a channel event to the simulated volumes */
+static void apply(const uint8_t *e)
+{
+    uint8_t channel = e[1] & 0x0F;
+
+    switch (e[1] & 0xF0)
+    {
+        case 0x10:
+            volume[channel] = e[2];
+            envelope[channel].steps = 0;
+            length[channel] = 0;
+            break;
+        case 0x50:
+        case 0x60:
+            volume[channel] = e[2] & 0x0F;
+            envelope[channel].delta = ((int8_t) e[2]) >> 4;
+            envelope[channel].period = envelope[channel].timer = e[3] & 0x0F;
+            envelope[channel].steps = e[3] >> 4;
+            length[channel] = (e[1] & 0x20) ? e[4] : 0;
+            break;
+    }
+}
+
+/* check the operands of a channel event */
+static void check_event(const uint8_t *e, size_t pos)
+{
+    uint8_t channel = e[1] & 0x0F;
+
+    switch (e[1] & 0xF0)
+    {
+        case 0x00:
+        case 0x10:
+        case 0x50:
+        case 0x60:
+        case 0x70:
+        case 0x80:
+            if (channel > 3)
+                error(pos, "event for channel %u", channel);
+            break;
+        /* only the squares have a duty cycle */
+        case 0x30:
+            if (channel > 1)
+                error(pos, "duty cycle for channel %u", channel);
+            break;
+    }
+
+    switch (e[1] & 0xF0)
+    {
+        case 0x10:
+            if (e[2] > 15)
+                error(pos, "volume %u", e[2]);
+            break;
+        case 0x50:
+        case 0x60:
+            if (!(e[3] & 0x0F) && (e[3] >> 4))
+                error(pos, "envelope with a period of 0", 0);
+            break;
+        case 0x70:
+            if (!(e[5] & 0x0F) && (e[5] >> 4))
+                error(pos, "sweep with a period of 0", 0);
+            break;
+        case 0x80:
+            if ((e[2] & 0x0F) > 8 || (e[2] >> 4) > 8)
+                error(pos, "pan 0x%02X has a gain over 8", e[2]);
+            break;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct level levels[PATTERN_DEPTH];
+    unsigned int depth = 0;
+    uint8_t *data;
+    size_t len, pos = 0;
+    unsigned long events = 0, keyframes = 0;
+    /* whether the last event was a keyframe point */
+    int after_keyframe = 0;
+    unsigned long repeat_frame = 0, budget, limit = 100;
+    uint16_t rate = SAMPLE_RATE;
+    uint8_t fps = FRAME_RATE;
+    unsigned long i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:pr:l:z")) != -1)
+    {
+        switch (opt)
+        {
+            case 'a':
+                rate = strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                fps = FRAME_RATE_PAL;
+                break;
+            case 'r':
+                cycles_per_sample = strtoul(optarg, NULL, 0);
+                break;
+            case 'l':
+                limit = strtoul(optarg, NULL, 0);
+                break;
+            case 'z':
+                byte_cycles = LZ_BYTE_CYCLES;
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+
+    if (optind != argc - 1 || rate < MIN_SAMPLE_RATE ||
+        rate > MAX_SAMPLE_RATE)
+    {
+        fprintf(stderr, "usage: %s [-a rate] [-p] [-r cycles] [-l percent] "
+                "[-z] song.inc\n"
+                "  -a rate     output sample rate (%u-%u, default %u)\n"
+                "  -p          50 frames per second (PAL)\n"
+                "  -r cycles   cycles to render a sample (default %u)\n"
+                "  -l percent  fail if the worst frame takes more than this\n"
+                "              much of a frame's time (default 100)\n"
+                "  -z          song is played compressed\n"
+                "the song must be uncompressed, as output by host/envpack "
+                "or host/patpack\n", argv[0], MIN_SAMPLE_RATE,
+                MAX_SAMPLE_RATE, SAMPLE_RATE, SAMPLE_CYCLES);
+        return 1;
+    }
+    path = argv[optind];
+    samples_per_frame = SAMPLES_PER_FRAME_AT(rate, fps);
+
+    if (!(data = songfile_load(path, &len)))
+        return 1;
+
+    /* walk the events until the jump to the repeat point, following */
+    /* loops and calls */
+    while (1)
+    {
+        const uint8_t *e = &data[pos];
+        size_t size;
+
+        if (pos + 1 >= len)
+        {
+            fprintf(stderr, "%s: runs off the end at byte %lu without a "
+                    "jump to the repeat point\n", path, (unsigned long) pos);
+            return 1;
+        }
+        size = songfile_event_length(e[1]);
+        if (pos + size > len)
+        {
+            fprintf(stderr, "%s: truncated event 0x%02X at byte %lu\n", path,
+                    e[1], (unsigned long) pos);
+            return 1;
+        }
+        if (++events > MAX_EVENTS)
+        {
+            fprintf(stderr, "%s: no jump to the repeat point after %lu "
+                    "events\n", path, MAX_EVENTS);
+            return 1;
+        }
+
+        /* a keyframe is saved and restored with the next event */
+        /* already decoded (see synth_save_keyframe), which only */
+        /* works if that event is in a later frame */
+        if (after_keyframe && !e[0])
+            error(pos, "keyframe point followed by an event in the "
+                  "same frame", 0);
+        after_keyframe = 0;
+
+        /* each event's frame is relative to the previous one, */
+        /* whatever kind it is */
+        if (frame + e[0] >= MAX_FRAMES)
+        {
+            fprintf(stderr, "%s: longer than %lu frames\n", path,
+                    MAX_FRAMES);
+            return 1;
+        }
+        for (i = 0; i < e[0]; i++)
+            next_frame();
+        frame_bytes += size;
+        pos += size;
+
+        switch (e[1] & 0xF0)
+        {
+            case 0x00:
+            case 0x10:
+            case 0x30:
+            case 0x40:
+            case 0x50:
+            case 0x60:
+            case 0x70:
+            case 0x80:
+                check_event(e, pos - size);
+                apply(e);
+                frame_events++;
+                continue;
+            case 0x20:
+                keyframes++;
+                after_keyframe = 1;
+                break;
+            case 0xE0:
+                repeat_frame = frame;
+                break;
+            /* loop start */
+            case 0xA0:
+                if (!e[2])
+                    error(pos - size, "loop count of 0 repeats 256 times", 0);
+                if (depth == PATTERN_DEPTH)
+                {
+                    error(pos - size, "loops and calls nested more than "
+                          "%u deep", PATTERN_DEPTH);
+                    return 1;
+                }
+                levels[depth].pos = pos;
+                levels[depth++].count = e[2];
+                break;
+            /* loop end */
+            case 0xB0:
+                if (!depth || !levels[depth - 1].count)
+                {
+                    error(pos - size, "loop end without a loop start", 0);
+                    return 1;
+                }
+                if (--levels[depth - 1].count)
+                    pos = levels[depth - 1].pos;
+                else
+                    depth--;
+                break;
+            /* pattern call */
+            case 0xC0:
+                if (depth == PATTERN_DEPTH)
+                {
+                    error(pos - size, "loops and calls nested more than "
+                          "%u deep", PATTERN_DEPTH);
+                    return 1;
+                }
+                if ((size_t) (e[2] | (e[3] << 8)) >= len)
+                {
+                    error(pos - size, "call to 0x%04X past the end",
+                          e[2] | (e[3] << 8));
+                    return 1;
+                }
+                levels[depth].pos = pos;
+                levels[depth++].count = 0;
+                pos = e[2] | (e[3] << 8);
+                break;
+            /* pattern return */
+            case 0xD0:
+                if (!depth || levels[depth - 1].count)
+                {
+                    error(pos - size, "return outside of a pattern", 0);
+                    return 1;
+                }
+                pos = levels[--depth].pos;
+                break;
+            case 0xF0:
+                if (depth)
+                    error(pos - size, "jump to the repeat point from "
+                          "inside a pattern", 0);
+                /* the core decodes ahead until it reaches a later */
+                /* frame, which a loop of no frames never does */
+                if (frame == repeat_frame)
+                {
+                    error(pos - size, "jump to the repeat point in its "
+                          "own frame, which would hang", 0);
+                    return 1;
+                }
+                break;
+            default:
+                error(pos - size, "unknown event 0x%02X", e[1]);
+                break;
+        }
+
+        frame_controls++;
+        if ((e[1] & 0xF0) == 0xF0)
+            break;
+    }
+
+    /* the jump's frame is the last one */
+    next_frame();
+
+    budget = F_CPU / fps;
+
+    printf("%s:\n", path);
+    printf("  length      %lu frames (%lu:%02lu), looping the last %lu\n",
+           frame, frame / fps / 60, frame / fps % 60, frame - repeat_frame);
+    printf("  events      %lu, %lu keyframe points\n", events, keyframes);
+    printf("  most events %u, at frame %lu\n", max_events, max_events_frame);
+    printf("  events per frame:\n");
+    for (i = 0; i < HISTOGRAM_SIZE; i++)
+    {
+        if (histogram[i])
+            printf("    %2lu%s %8lu\n", i,
+                   (i == HISTOGRAM_SIZE - 1) ? "+" : " ", histogram[i]);
+    }
+    printf("  worst frame about %lu of %lu cycles (%lu%%), at frame %lu\n",
+           max_cycles, budget, max_cycles * 100 / budget, max_cycles_frame);
+
+    if (max_cycles * 100 > budget * limit)
+    {
+        fprintf(stderr, "%s: worst frame takes more than %lu%% of a "
+                "frame's time\n", path, limit);
+        errors++;
+    }
+
+    free(data);
+
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,122 @@
+/* File:    songfile.c
+   Author:  Frank Dischner
+   Purpose: Contains the host routines which read and write song data in
+            the .inc format used by songs.c
+*/
+
+#include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "songfile.h"
+
+/* load every 0x.. byte from a .inc file, skipping comments */
+uint8_t *songfile_load(const char *path, size_t *len)
+{
+    FILE *f;
+    uint8_t *data = NULL;
+    size_t size = 0;
+    int c, prev = 0;
+
+    if (!(f = fopen(path, "r")))
+    {
+        perror(path);
+        return NULL;
+    }
+
+    *len = 0;
+    while ((c = fgetc(f)) != EOF)
+    {
+        /* skip comments */
+        if (prev == '/' && c == '*')
+        {
+            prev = 0;
+            while ((c = fgetc(f)) != EOF && !(prev == '*' && c == '/'))
+                prev = c;
+            prev = 0;
+            continue;
+        }
+
+        if (prev == '0' && (c == 'x' || c == 'X'))
+        {
+            char hex[3] = { 0, 0, 0 };
+            int i;
+
+            for (i = 0; i < 2 && (c = fgetc(f)) != EOF && isxdigit(c); i++)
+                hex[i] = c;
+
+            if (*len == size)
+            {
+                size = size ? size * 2 : 4096;
+                data = realloc(data, size);
+                if (!data)
+                {
+                    fprintf(stderr, "%s: out of memory\n", path);
+                    exit(1);
+                }
+            }
+            data[(*len)++] = strtoul(hex, NULL, 16);
+            prev = 0;
+            continue;
+        }
+
+        prev = c;
+    }
+
+    fclose(f);
+
+    if (!data)
+        data = malloc(1);
+
+    return data;
+}
+
+/* write bytes in the same layout as the song .inc files */
+void songfile_write(FILE *f, const uint8_t *data, size_t len,
+                    const char *comment)
+{
+    size_t i;
+
+    if (comment)
+        fprintf(f, "    /* %s */\n", comment);
+
+    for (i = 0; i < len; i++)
+    {
+        if (i % 12 == 0)
+            fprintf(f, "   ");
+        fprintf(f, " 0x%02X,", data[i]);
+        if (i % 12 == 11 || i == len - 1)
+            fprintf(f, "\n");
+    }
+}
+
+/* number of bytes in an event, including the delta and command */
+size_t songfile_event_length(uint8_t command)
+{
+    switch (command & 0xF0)
+    {
+        /* step (frequency), envelope and pattern call */
+        case 0x00:
+        case 0x50:
+        case 0xC0:
+            return 4;
+        /* envelope with length counter */
+        case 0x60:
+            return 5;
+        /* sweep */
+        case 0x70:
+            return 6;
+        /* volume, duty cycle, noise channel mode, pan and loop start */
+        case 0x10:
+        case 0x30:
+        case 0x40:
+        case 0x80:
+        case 0xA0:
+            return 3;
+        /* keyframe point, repeat point, jump, loop end, */
+        /* pattern return and unknown */
+        default:
+            return 2;
+    }
+}
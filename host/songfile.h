@@ -0,0 +1,19 @@
+/* File:    songfile.h
+   Author:  Frank Dischner
+   Purpose: Contains prototypes for the host routines which read and write
+            song data in the .inc format used by songs.c
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef SONGFILE_H
+#define SONGFILE_H
+
+uint8_t *songfile_load(const char *path, size_t *len);
+void songfile_write(FILE *f, const uint8_t *data, size_t len,
+                    const char *comment);
+size_t songfile_event_length(uint8_t command);
+
+#endif /* SONGFILE_H */
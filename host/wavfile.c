@@ -0,0 +1,56 @@
+/* File:    wavfile.c
+   Author:  Frank Dischner
+   Purpose: Contains the host routines which write the output of the
+            synthesis core as WAV or raw PCM
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include "wavfile.h"
+
+static void put_le(FILE *f, uint32_t value, int bytes)
+{
+    while (bytes--)
+    {
+        fputc(value & 0xFF, f);
+        value >>= 8;
+    }
+}
+
+void wavfile_write_header(FILE *f, uint32_t samples, uint32_t rate)
+{
+    /* unsigned 8-bit PCM, which is exactly our output format, or */
+    /* signed 16-bit PCM for the 16-bit mix (see wavfile_to_pcm) */
+    fwrite("RIFF", 1, 4, f);
+    put_le(f, 36 + samples * SAMPLE_BYTES, 4);
+    fwrite("WAVEfmt ", 1, 8, f);
+    put_le(f, 16, 4);
+    put_le(f, 1, 2);
+    put_le(f, PCM_CHANNELS, 2);
+    put_le(f, rate, 4);
+    put_le(f, rate * SAMPLE_BYTES, 4);
+    put_le(f, SAMPLE_BYTES, 2);
+    put_le(f, PCM_BITS, 2);
+    fwrite("data", 1, 4, f);
+    put_le(f, samples * SAMPLE_BYTES, 4);
+}
+
+/* convert the core's output to PCM_FORMAT in place, which only */
+/* changes the two byte output, unsigned with the high byte first, */
+/* to signed 16-bit little endian */
+void wavfile_to_pcm(uint8_t *buf, uint16_t count)
+{
+#ifdef DUAL_PWM
+    while (count--)
+    {
+        uint8_t hi = buf[0] ^ 0x80;
+
+        buf[0] = buf[1];
+        buf[1] = hi;
+        buf += 2;
+    }
+#else
+    (void) buf;
+    (void) count;
+#endif
+}
@@ -0,0 +1,32 @@
+/* File:    wavfile.h
+   Author:  Frank Dischner
+   Purpose: Contains prototypes for the host routines which write the
+            output of the synthesis core as WAV or raw PCM
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include "synth.h"
+
+#ifndef WAVFILE_H
+#define WAVFILE_H
+
+/* output format, which follows the core's (see synth.h) */
+#if defined(STEREO)
+#define PCM_CHANNELS 2
+#define PCM_BITS     8
+#define PCM_FORMAT   "unsigned 8-bit stereo"
+#elif defined(DUAL_PWM)
+#define PCM_CHANNELS 1
+#define PCM_BITS     16
+#define PCM_FORMAT   "signed 16-bit"
+#else
+#define PCM_CHANNELS 1
+#define PCM_BITS     8
+#define PCM_FORMAT   "unsigned 8-bit"
+#endif
+
+void wavfile_write_header(FILE *f, uint32_t samples, uint32_t rate);
+void wavfile_to_pcm(uint8_t *buf, uint16_t count);
+
+#endif /* WAVFILE_H */
@@ -1,6 +1,9 @@
 /* File:    lcd.c
    Author:  Frank Dischner
-   Purpose: Contains implementation of all LCD related routines
+   Purpose: Contains implementation of all LCD related routines. Apart
+            from lcdinit, they only queue their writes, which lcdupdate
+            then sends a few at a time while the LCD isn't busy, so the
+            main loop never waits on the LCD.
 */
 
 #include <stdint.h>
@@ -24,6 +27,28 @@
 
 #define LCD_BUSY_MASK 0x80
 
+/* queued writes, must be a power of two */
+/* a song change queues a little over 100 of them */
+#define LCD_QUEUE_SIZE 128
+/* most writes sent by one call to lcdupdate */
+#define LCD_UPDATE_MAX 4
+
+struct lcd_write
+{
+    uint8_t data;
+    uint8_t rs;
+};
+
+static struct lcd_write queue[LCD_QUEUE_SIZE];
+/* index of next write to send */
+static uint8_t queue_head = 0;
+/* number of writes waiting to be sent */
+static uint8_t queue_count = 0;
+/* address the cursor will be at once the queue is sent, */
+/* which is kept here since the LCD can't be asked for it */
+/* until then */
+static uint8_t cursor = 0;
+
 static void lcdwrite(uint8_t data, uint8_t rs)
 {
     /* set data port as output */
@@ -85,6 +110,49 @@ void lcdbusywait(void)
     while (lcdread(INSTR) & LCD_BUSY_MASK);
 }
 
+/* send the next queued write */
+static void lcdsend(void)
+{
+    struct lcd_write *w = &queue[queue_head];
+
+    lcdwrite(w->data, w->rs);
+    queue_head = (queue_head + 1) & (LCD_QUEUE_SIZE - 1);
+    queue_count--;
+}
+
+static void lcdqueue(uint8_t data, uint8_t rs)
+{
+    struct lcd_write *w;
+
+    /* if the queue is full, which takes far more text than */
+    /* the display holds, wait for room instead of losing it */
+    while (queue_count == LCD_QUEUE_SIZE)
+    {
+        lcdbusywait();
+        lcdsend();
+    }
+
+    w = &queue[(queue_head + queue_count) & (LCD_QUEUE_SIZE - 1)];
+    w->data = data;
+    w->rs = rs;
+    queue_count++;
+}
+
+/* send queued writes until the LCD is busy, up to LCD_UPDATE_MAX */
+/* of them, so this never waits and takes a few microseconds */
+void lcdupdate(void)
+{
+    uint8_t n = LCD_UPDATE_MAX;
+
+    while (queue_count && n--)
+    {
+        if (lcdread(INSTR) & LCD_BUSY_MASK)
+            return;
+
+        lcdsend();
+    }
+}
+
 // initialize the LCD
 void lcdinit(void)
 {
@@ -116,12 +184,15 @@ void lcdinit(void)
     // auto increment on, shift off
     lcdbusywait();
     lcdwrite(0x06, INSTR);
+
+    queue_head = queue_count = 0;
+    cursor = 0;
 }
 
 void lcdgotoaddr(unsigned char addr)
 {
-    lcdbusywait();
-    lcdwrite(0x80 | addr, INSTR);
+    lcdqueue(0x80 | addr, INSTR);
+    cursor = addr;
 }
 
 void lcdgotoxy(unsigned char row, unsigned char column)
@@ -146,19 +217,13 @@ void lcdgotoxy(unsigned char row, unsigned char column)
 
 void lcdputch(char cc)
 {
-    lcdbusywait();
-    lcdwrite(cc, DATA);
+    lcdqueue(cc, DATA);
+    cursor++;
 }
 
 void lcdputstr(char *ss)
 {
-    unsigned char addr;
-
-    lcdbusywait();
-    // seems we need an extra delay before reading the address
-    _delay_us(10);
-    // get current address
-    addr = lcdread(INSTR) & 0x7F;
+    unsigned char addr = cursor;
 
     // write all characters
     while (*ss)
@@ -185,15 +250,9 @@ void lcdputstr(char *ss)
 
 void lcdputstr_P(uint32_t ss)
 {
-    unsigned char addr;
+    unsigned char addr = cursor;
     char c;
 
-    lcdbusywait();
-    // seems we need an extra delay before reading the address
-    _delay_us(30);
-    // get current address
-    addr = lcdread(INSTR) & 0x7F;
-
     // write all characters
     while ((c = pgm_read_byte_far(ss++)))
     {
@@ -219,8 +278,8 @@ void lcdputstr_P(uint32_t ss)
 
 void lcdclear(void)
 {
-    lcdbusywait();
-    lcdwrite(0x01, INSTR);
+    lcdqueue(0x01, INSTR);
+    cursor = 0;
 }
 
 void lcdclearline(unsigned char row)
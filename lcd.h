@@ -17,5 +17,6 @@ void lcdputstr(char *ss);
 void lcdputstr_P(uint32_t ss);
 void lcdclear(void);
 void lcdclearline(unsigned char row);
+void lcdupdate(void);
 
 #endif /* _LCD_H_ */
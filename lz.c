@@ -0,0 +1,77 @@
+/* File:    lz.c
+   Author:  Frank Dischner
+   Purpose: Contains the streaming decompressor used for compressed song
+            data (see lz.h for the format)
+*/
+
+#include <stdint.h>
+#include "platform.h"
+#include "lz.h"
+
+/* start decompressing from a restart point */
+void lz_seek(struct lz *lz, uint32_t addr)
+{
+    lz->pos = addr;
+    lz->tokens = 0;
+    lz->copy_left = 0;
+}
+
+/* skip the rest of the current group, making this a restart point */
+/* returns the address to pass to lz_seek to restart from here */
+uint32_t lz_sync(struct lz *lz)
+{
+    lz->tokens = 0;
+
+    return lz->pos;
+}
+
+/* decompress the next byte */
+/* this never needs more than three program memory reads, */
+/* so the cost of decoding an event is bounded */
+uint8_t lz_read_byte(struct lz *lz)
+{
+    uint8_t c;
+
+    if (!lz->copy_left)
+    {
+        /* start a new group */
+        if (!lz->tokens)
+        {
+            lz->flags = platform_read_byte(lz->pos++);
+            lz->tokens = 8;
+        }
+        lz->tokens--;
+
+        if (lz->flags & 0x1)
+        {
+            /* literal */
+            lz->flags >>= 1;
+            c = platform_read_byte(lz->pos++);
+            lz->window[lz->win_pos] = c;
+            lz->win_pos = (lz->win_pos + 1) & (LZ_WINDOW_SIZE - 1);
+
+            return c;
+        }
+        else
+        {
+            /* match */
+            uint8_t lo, hi;
+
+            lz->flags >>= 1;
+            lo = platform_read_byte(lz->pos++);
+            hi = platform_read_byte(lz->pos++);
+            lz->copy_left = (hi >> 2) + LZ_MIN_MATCH;
+            lz->copy_from = (lz->win_pos - (lo | ((hi & 0x3) << 8)) - 1) &
+                            (LZ_WINDOW_SIZE - 1);
+        }
+    }
+
+    /* copy one byte of the match */
+    c = lz->window[lz->copy_from];
+    lz->copy_from = (lz->copy_from + 1) & (LZ_WINDOW_SIZE - 1);
+    lz->copy_left--;
+    lz->window[lz->win_pos] = c;
+    lz->win_pos = (lz->win_pos + 1) & (LZ_WINDOW_SIZE - 1);
+
+    return c;
+}
@@ -0,0 +1,52 @@
+/* File:    lz.h
+   Author:  Frank Dischner
+   Purpose: Contains the format definition and prototypes for the streaming
+            decompressor used for compressed song data
+*/
+
+#include <stdint.h>
+
+#ifndef LZ_H
+#define LZ_H
+
+/* A compressed stream is a series of groups, each made of a flag byte
+   followed by up to eight tokens. The flag bits are used lsb first: a set
+   bit is a literal byte, a clear bit is a two byte match:
+
+       byte 0: low 8 bits of (distance - 1)
+       byte 1: bits 0-1 are the high bits of (distance - 1),
+               bits 2-7 are (length - LZ_MIN_MATCH)
+
+   which copies length bytes starting distance bytes back in the output.
+   After any event that sets a repeat point or marks a keyframe point, the
+   rest of the current group is skipped, so the stream can later be
+   restarted from that point. No match ever reaches back past a restart
+   point. */
+
+#define LZ_WINDOW_SIZE 1024
+#define LZ_MIN_MATCH   3
+#define LZ_MAX_MATCH   (LZ_MIN_MATCH + 63)
+
+struct lz
+{
+    /* next compressed byte */
+    uint32_t pos;
+    /* flags for the rest of the current group */
+    uint8_t flags;
+    /* tokens left in the current group */
+    uint8_t tokens;
+    /* bytes left to copy for the current match */
+    uint8_t copy_left;
+    /* window index to copy the next match byte from */
+    uint16_t copy_from;
+    /* window index of the next output byte */
+    uint16_t win_pos;
+    /* the most recent output */
+    uint8_t window[LZ_WINDOW_SIZE];
+};
+
+void lz_seek(struct lz *lz, uint32_t addr);
+uint32_t lz_sync(struct lz *lz);
+uint8_t lz_read_byte(struct lz *lz);
+
+#endif /* LZ_H */
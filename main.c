@@ -8,10 +8,64 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include "playback.h"
+#include "synth.h"
 #include "songs.h"
+#include "sfx.h"
 #include "controller.h"
 #include "lcd.h"
 
+/* seconds to seek with UP/DOWN, at the current frame rate */
+#define SEEK_SECONDS 10
+/* song frames per output frame while fast forwarding */
+#define FAST_FORWARD_SPEED 8
+
+/* the main loop runs once per output chunk, so times are counted */
+/* in loops, of which there are this many a second */
+static uint16_t loops_per_second(void)
+{
+    return synth_get_rate() / CHUNK_SIZE;
+}
+
+#ifdef SHOW_STATS
+static void lcdputnum(uint16_t n)
+{
+    char digits[5];
+    uint8_t i = 0;
+
+    do
+    {
+        digits[i++] = '0' + n % 10;
+        n /= 10;
+    } while (n);
+
+    while (i)
+        lcdputch(digits[--i]);
+}
+
+/* show the average and highest load, the number of underruns */
+/* and the time left idle, all but the underruns in percent */
+/* The line doesn't wrap, so the fields are run together and the */
+/* underruns stop at 999, which fits it in 16 columns even at */
+/* A255M255U999I100. */
+static void show_stats(void)
+{
+    struct playback_stats stats;
+
+    playback_get_stats(&stats);
+
+    lcdclearline(2);
+    lcdgotoxy(2, 0);
+    lcdputch('A');
+    lcdputnum(stats.avg_load);
+    lcdputch('M');
+    lcdputnum(stats.max_load);
+    lcdputch('U');
+    lcdputnum((stats.underruns > 999) ? 999 : stats.underruns);
+    lcdputch('I');
+    lcdputnum(stats.idle);
+}
+#endif /* SHOW_STATS */
+
 int main(void)
 {
     /* enable all pullups to prevent floating inputs */
@@ -32,9 +86,11 @@ int main(void)
     playback_init();
     /* initialize song data */
     songs_init();
+    /* initialize sound effect data */
+    sfx_init();
 
     /* set initial song */
-    playback_set_song(cur_song_data());
+    playback_set_song(cur_song_data(), cur_song_keyframes());
     /* display song name */
     lcdputstr_P(cur_song_name());
     /* display playback status */
@@ -48,16 +104,17 @@ int main(void)
     while (1)
     {
         static uint8_t prev_buttons = 0;
+        static uint16_t held = 0;
         uint8_t buttons;
         uint8_t changed;
 
         /* set pin high so we can time the loop */
         /* this allows us to measure how long
-           it takes to process each frame */
+           it takes to render the output chunks */
         PORTB |= (1 << PB0);
 
-        /* process one frame */
-        playback_process_frame();
+        /* render any free output chunks */
+        playback_update();
 
         /* process user input */
 
@@ -69,6 +126,34 @@ int main(void)
         prev_buttons = buttons;
         /* check which buttons were pressed */
         buttons = changed & prev_buttons;
+
+        /* fast forward while UP is held for more than half */
+        /* a second, after its seek */
+        if (prev_buttons & BUTTON_UP)
+        {
+            uint16_t hold = loops_per_second() / 2;
+
+            if (held < hold && ++held == hold &&
+                playback_get_state() == PLAYBACK_STATE_PLAYING)
+            {
+                playback_fast_forward(FAST_FORWARD_SPEED);
+                lcdclearline(3);
+                lcdgotoxy(3, 0);
+                lcdputstr_P((uint32_t) PSTR("Fast forward"));
+            }
+        }
+        else
+        {
+            /* back to normal speed once it is released */
+            if (playback_get_state() == PLAYBACK_STATE_FAST_FORWARD)
+            {
+                playback_play();
+                lcdclearline(3);
+                lcdgotoxy(3, 0);
+                lcdputstr_P((uint32_t) PSTR("Playing"));
+            }
+            held = 0;
+        }
         if (buttons & BUTTON_START)
         {
             /* clear status line */
@@ -99,6 +184,25 @@ int main(void)
             lcdgotoxy(3, 0);
             lcdputstr_P((uint32_t) PSTR("Stopped"));
         }
+        else if (buttons & (BUTTON_A | BUTTON_B))
+        {
+            /* play a sound effect over the song, */
+            /* which only moves on while it plays */
+            if (playback_get_state() == PLAYBACK_STATE_PLAYING ||
+                playback_get_state() == PLAYBACK_STATE_FAST_FORWARD)
+                playback_play_sfx(sfx_data((buttons & BUTTON_A) ?
+                                           SFX_COIN : SFX_HIT));
+        }
+        else if (buttons & BUTTON_UP)
+        {
+            /* seek forward */
+            playback_seek(SEEK_SECONDS * synth_get_frame_rate());
+        }
+        else if (buttons & BUTTON_DOWN)
+        {
+            /* seek back */
+            playback_seek(-SEEK_SECONDS * synth_get_frame_rate());
+        }
         else if (buttons & BUTTON_LEFT)
         {
             uint8_t state;
@@ -108,15 +212,23 @@ int main(void)
             /* stop playback */
             playback_stop();
             /* set prev song */
-            playback_set_song(prev_song());
+            prev_song();
+            playback_set_song(cur_song_data(), cur_song_keyframes());
+            /* timing is kept per song */
+            playback_reset_stats();
             lcdclearline(0);
             lcdclearline(1);
             lcdgotoaddr(0);
             lcdputstr_P(cur_song_name());
-            /* restart playback */
-            if (state == PLAYBACK_STATE_PLAYING)
+            /* restart playback, at normal speed if it was */
+            /* fast forwarding */
+            if (state == PLAYBACK_STATE_PLAYING ||
+                state == PLAYBACK_STATE_FAST_FORWARD)
             {
                 playback_play();
+                lcdclearline(3);
+                lcdgotoxy(3, 0);
+                lcdputstr_P((uint32_t) PSTR("Playing"));
             }
             else
             {
@@ -137,15 +249,23 @@ int main(void)
             /* stop playback */
             playback_stop();
             /* set next song */
-            playback_set_song(next_song());
+            next_song();
+            playback_set_song(cur_song_data(), cur_song_keyframes());
+            /* timing is kept per song */
+            playback_reset_stats();
             lcdclearline(0);
             lcdclearline(1);
             lcdgotoaddr(0);
             lcdputstr_P(cur_song_name());
-            /* restart playback */
-            if (state == PLAYBACK_STATE_PLAYING)
+            /* restart playback, at normal speed if it was */
+            /* fast forwarding */
+            if (state == PLAYBACK_STATE_PLAYING ||
+                state == PLAYBACK_STATE_FAST_FORWARD)
             {
                 playback_play();
+                lcdclearline(3);
+                lcdgotoxy(3, 0);
+                lcdputstr_P((uint32_t) PSTR("Playing"));
             }
             else
             {
@@ -158,10 +278,26 @@ int main(void)
             }
         }
 
+#ifdef SHOW_STATS
+        {
+            static uint16_t stats_loops = 0;
+
+            /* update the timing line about once a second */
+            if (++stats_loops >= loops_per_second())
+            {
+                stats_loops = 0;
+                show_stats();
+            }
+        }
+#endif
+
+        /* send some of any queued LCD writes */
+        lcdupdate();
+
         /* set pin low to end loop timing */
         PORTB &= ~(1 << PB0);
 
-        /* wait for next frame start */
-        wait_vblank();
+        /* wait for an output chunk to become free */
+        playback_wait();
     }
 }
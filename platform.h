@@ -0,0 +1,38 @@
+/* File:    platform.h
+   Author:  Frank Dischner
+   Purpose: Contains the few platform specific routines needed by the
+            synthesis core and song data, so they can be built either for
+            the AVR or for a host machine
+*/
+
+#include <stdint.h>
+
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#ifdef __AVR__
+
+#include <avr/pgmspace.h>
+
+/* song data can live anywhere in the 128K of program memory, */
+/* so it is always addressed with a 32-bit 'pointer' */
+#define platform_read_byte(addr)  pgm_read_byte_far(addr)
+#define platform_far_address(var) pgm_get_far_address(var)
+
+#else
+
+/* on the host, data is just regular memory */
+#define PROGMEM
+typedef uint8_t prog_uint8_t;
+typedef char prog_char;
+
+/* the host has no flat 32-bit address space for the data, so each */
+/* array is registered and given an address of (index << 24) + offset */
+uint32_t platform_register(const void *data, uint32_t size);
+uint8_t platform_read_byte(uint32_t addr);
+
+#define platform_far_address(var) platform_register(&(var), sizeof(var))
+
+#endif /* __AVR__ */
+
+#endif /* PLATFORM_H */
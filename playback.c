@@ -7,172 +7,148 @@
 #include <string.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
-#include <avr/pgmspace.h>
+#include <avr/sleep.h>
 #include "playback.h"
-
-/* 40kHz / 60 fps */
-#define SAMPLES_PER_FRAME 667
-
-/* vblank indicates that output buffers have been swapped */
-static volatile uint8_t vblank = 0;
-/* index of currently playing output buffer */
-static volatile uint8_t out_idx = 0;
-/* state needed for wave generation */
-static uint16_t step[4] = { 0, 0, 0, 0 };
-static int8_t volume[4] = { 0, 0, 0, 0 };
-static uint8_t duty[2] = { 0x80, 0x80 };
-static uint16_t phase[4] = { 0, 0, 0, 0 };
-static uint16_t lfsr = 1;
-static uint8_t lfsr_mode = 0;
-/* double buffered output */
-static uint8_t outbuf[2][SAMPLES_PER_FRAME];
+#include "synth.h"
+#include "bench.h"
+
+/* these are shared with the assembly interrupt routine in isr.S */
+/* ring of output chunks, of SAMPLE_BYTES per sample */
+uint8_t outbuf[NUM_CHUNKS * CHUNK_SIZE * SAMPLE_BYTES];
+/* number of chunks the interrupt has finished playing (wraps) */
+volatile uint8_t chunks_played = 0;
+/* end of the chunk currently being played (assembly interrupt only) */
+uint8_t *chunk_end;
+
+/* number of chunks that have been rendered (wraps) */
+/* the whole ring starts out filled with silence */
+static uint8_t chunks_rendered = NUM_CHUNKS;
+/* next chunk to render */
+static uint8_t fill_idx = 0;
+/* samples left to render in the current frame */
+static uint16_t frame_left = 0;
 /* current playback state */
 static uint8_t state = PLAYBACK_STATE_STOPPED;
-/* 'pointers' to song info */
-static uint32_t song_start = 0;
-static uint32_t song_repeat = 0;
-static uint32_t song_pos = 0;
-/* current frame */
-static uint16_t frame = 0;
-/* last frame containing an event */
-static uint16_t last_frame = 0;
-
+/* song frames per output frame while fast forwarding */
+static uint8_t speed = 1;
+/* frames left to replay for a seek (see playback_seek) */
+static uint16_t seek_left = 0;
+
+/* Frames replayed for a seek in place of each output chunk. Only */
+/* the events are applied, so a frame costs a few thousand cycles */
+/* at most, against the tens of thousands a chunk lasts. */
+#ifndef SEEK_CHUNK_FRAMES
+#define SEEK_CHUNK_FRAMES 8
+#endif
+
+/* timer 1 count for one sample, which the timer resets after */
+#define TIMER_TOP(rate) (((F_CPU) + (rate) / 2) / (rate) - 1)
+
+/* Work on each frame is timed with timer 3, which runs freely at */
+/* 1/8 of the CPU clock, so a frame's time fits in 16 bits. The */
+/* times include any interrupts taken meanwhile, since those take */
+/* the time away from rendering just the same. */
+#define STATS_PRESCALE 8
+
+/* ticks spent on the current frame so far */
+static uint16_t frame_ticks = 0;
+/* song frame being rendered */
+static uint16_t stats_frame = 0;
+/* ticks spent on the last frame, the most on any frame, */
+/* and the average times 16 */
+static uint16_t last_ticks = 0;
+static uint16_t max_ticks = 0;
+static uint32_t avg_ticks16 = 0;
+/* song frame which took max_ticks */
+static uint16_t max_frame = 0;
+/* number of chunks played before they were rendered */
+static uint16_t underruns = 0;
+
+/* Time spent asleep in playback_wait is counted over windows of */
+/* about a quarter second, giving the share of time left over. */
+#define IDLE_WINDOW ((F_CPU) / STATS_PRESCALE / 4)
+
+/* ticks asleep in total (wraps) and in the current window */
+static uint32_t idle_total = 0;
+static uint32_t idle_ticks = 0;
+/* length of the current window so far, and where it was last updated */
+static uint32_t window_ticks = 0;
+static uint16_t window_last = 0;
+/* percentage of the last full window spent asleep */
+static uint8_t idle_percent = 0;
+
+#ifndef ASM_ISR
 /* interrupt routine used to output samples */
+/* isr.S has a faster version, used when ASM_ISR is defined */
 ISR(TIMER1_COMPA_vect)
 {
     static unsigned int count = 0;
-    static uint8_t *p = outbuf[0];
+    static uint8_t *p = outbuf;
 
     /* output sample */
     OCR0A = *p++;
-
-    /* clear vblank if it was set last time */
-    vblank = 0;
+#if SAMPLE_BYTES == 2
+    OCR0B = *p++;
+#endif
 
     /* increment sample counter */
-    if (++count == SAMPLES_PER_FRAME)
+    if (++count == CHUNK_SIZE)
     {
-        /* swap output buffer */
-        out_idx = 1 - out_idx;
-        p = outbuf[out_idx];
-        /* indicate that buffer swap has occurred */
-        vblank = 1;
+        /* wrap around at the end of the ring */
+        if (p == outbuf + NUM_CHUNKS * CHUNK_SIZE * SAMPLE_BYTES)
+            p = outbuf;
+        /* indicate that the chunk is free */
+        chunks_played++;
         /* reset sample counter */
         count = 0;
     }
 }
-
-static void calculate_frame(uint8_t *buf)
-{
-    int i;
-
-    /* calculate all samples in frame */
-    for (i = 0; i < SAMPLES_PER_FRAME; i++)
-    {
-        int8_t tmp1, tmp2;
-
-        /* Parts of this algorithm, namely the square and triangle waves, */
-        /* were inspired by the assembly code in Craft by Linus Akesson */
-        /* http://www.linusakesson.net/scene/craft/index.php */
-
-        /* first square wave */
-        phase[0] += step[0];
-        tmp1 = volume[0];
-        if (((phase[0] >> 8) & 0xE0) >= duty[0])
-        {
-            tmp1 = -tmp1;
-        }
-
-        /* second square wave */
-        phase[1] += step[1];
-        if (((phase[1] >> 8) & 0xE0) >= duty[1])
-        {
-            tmp1 -= volume[1];
-        }
-        else
-        {
-            tmp1 += volume[1];
-        }
-
-        /* triangle wave */
-        /* to prevent pops in the output, caused by discontinuities,   */
-        /* the triangle output is always 'on', but stays at a constant */
-        /* value when not playing. This adds a DC offset, but its much */
-        /* simpler than trying to filter it and the NES does the same. */
-        if (volume[2])
-            phase[2] += step[2];
-
-        /* top 7 bits of the phase are the output level */
-        /* the upper half of the phase range is negated */
-        /* to give output values 0 -> 64 -> 0 (triangle) */
-        /* instead of 0 -> 127 (sawtooth) */
-        tmp2 = (((int16_t) phase[2]) >> 9);
-        if (tmp2 & 0x80)
-            tmp2 = -tmp2;
-        tmp1 += tmp2;
-
-        /* noise */
-        /* only increment the lfsr if channel is on */
-        if (volume[3])
-            phase[3] += step[3];
-
-        /* lsb determines output value */
-        tmp2 = (lfsr & 0x1) ? -volume[3] : volume[3];
-        tmp1 += tmp2;
-        /* clock lfsr */
-        if (phase[3] & 0x8000)
-        {
-            uint8_t tap1, tap2;
-
-            /* first tap is always lsb */
-            tap1 = lfsr & 0x1;
-            /* second tap depends on mode (short/long) */
-            if (lfsr_mode)
-                tap2 = (lfsr & (1 << 6)) ? 1 : 0;
-            else
-                tap2 = (lfsr & (1 << 1)) ? 1 : 0;
-
-            /* shift right */
-            lfsr >>= 1;
-            /* load bit 14 to give a 15 bit lfsr */
-            if (tap1 ^ tap2)
-                lfsr |= (1 << 14);
-
-            /* decrement phase counter */
-            phase[3] ^= 0x8000;
-        }
-
-        /* normalize range to 0-255 */
-        /* 128 for DC offset and 32 for triangle offset */
-        *buf++ = (uint8_t) (tmp1 + 128 - 32);
-    }
-}
+#endif /* ASM_ISR */
 
 void playback_init(void)
 {
     /* initialize buffers with silence */
-    memset(outbuf, 0x80, 2 * SAMPLES_PER_FRAME);
-
+    memset(outbuf, 0x80, NUM_CHUNKS * CHUNK_SIZE * SAMPLE_BYTES);
+
+#if SAMPLE_BYTES == 2
+    /* set PB3 (OC0A) and PB4 (OC0B) as outputs */
+    /* OC0A carries the first byte of each sample and OC0B the second, */
+    /* which are the left and right outputs in stereo, or otherwise */
+    /* the high and low bytes, the low byte meant to be mixed in */
+    /* through a resistor 256 times larger than that of OC0A */
+    DDRB |= (1 << PB3) | (1 << PB4);
+
+    /* set fast PWM and compare outputs A and B non-inverting */
+    TCCR0A = 0xA3;
+#else
     /* set PB3 (OC0A) as output */
     DDRB |= (1 << PB3);
 
     /* set fast PWM and compare output A non-inverting */
     TCCR0A = 0x83;
+#endif
     /* stop timer */
     TCCR0B = 0x00;
     /* reset counter */
     TCNT0 = 0x00;
     /* zero (signed) output */
     OCR0A = 0x80;
+    OCR0B = 0x80;
     /* start clock, no prescaler */
     TCCR0B = 0x01;
 
+#ifdef ASM_ISR
+    /* the assembly interrupt keeps its output pointer in GPIOR1/2 */
+    GPIOR1 = (uint16_t) outbuf & 0xFF;
+    GPIOR2 = (uint16_t) outbuf >> 8;
+    chunk_end = outbuf + CHUNK_SIZE * SAMPLE_BYTES;
+#endif
+
     /* stop timer and set reset on OCR1A match */
     TCCR1A = 0x00;
     TCCR1B = 0x08;
-    /* match when count reaches 500 (40KHz with 20MHz clock) */
-    OCR1AH = 0x01;
-    OCR1AL = 0xF4;
+    /* match once per sample */
+    OCR1A = TIMER_TOP(SAMPLE_RATE);
     /* reset counter */
     TCNT1H = 0x00;
     TCNT1L = 0x00;
@@ -180,23 +156,24 @@ void playback_init(void)
     TIMSK1 = 0x02;
     /* start timer with no prescaler */
     TCCR1B |= 0x01;
+
+    /* start timer 3 running freely with 1/8 prescaler */
+    TCCR3A = 0x00;
+    TCCR3B = 0x02;
+
+    /* idle sleep stops only the CPU, so the timers keep running */
+    /* and the sample interrupt wakes it up again */
+    set_sleep_mode(SLEEP_MODE_IDLE);
 }
 
 void playback_stop(void)
 {
     state = PLAYBACK_STATE_STOPPED;
 
-    /* reset output state */
-    step[0] = step[1] = step[2] = step[3] = 0;
-    volume[0] = volume[1] = volume[2] = volume[3] = 0;
-    duty[0] = duty[1] = 0x80;
-    phase[0] = phase[1] = phase[2] = phase[3] = 0;
-    lfsr = 1;
-    lfsr_mode = 0;
-    frame = last_frame = 0;
-
-    /* reset song to beginning */
-    song_pos = song_repeat = song_start;
+    /* reset synthesis state and rewind song */
+    synth_reset();
+    frame_left = 0;
+    seek_left = 0;
 }
 
 void playback_play(void)
@@ -209,85 +186,304 @@ void playback_pause(void)
     state = PLAYBACK_STATE_PAUSED;
 }
 
+/* play the given number of song frames for each frame of output, */
+/* only rendering the last of them, so the cost stays close to that */
+/* of normal playback */
+/* use playback_play to return to normal speed */
+void playback_fast_forward(uint8_t frames)
+{
+    if (frames < 1)
+        frames = 1;
+    if (frames > PLAYBACK_MAX_SPEED)
+        frames = PLAYBACK_MAX_SPEED;
+
+    speed = frames;
+    state = PLAYBACK_STATE_FAST_FORWARD;
+}
+
 uint8_t playback_get_state(void)
 {
     return state;
 }
 
-void playback_set_song(uint32_t addr)
+void playback_set_song(uint32_t addr, uint32_t keyframes)
+{
+    synth_set_song(addr);
+    synth_set_keyframes(keyframes);
+    frame_left = 0;
+    seek_left = 0;
+}
+
+/* change the output rate and frames per second (see synth_set_rate) */
+/* returns 0 if either is out of range */
+uint8_t playback_set_rate(uint16_t rate, uint8_t fps)
+{
+    uint8_t sreg;
+
+    if (!synth_set_rate(rate, fps))
+        return 0;
+
+    /* the counter is reset too, since it may already be past the */
+    /* new top, and would otherwise run on until it wraps */
+    /* 16-bit registers share a temporary byte, so the writes must */
+    /* not be interrupted */
+    sreg = SREG;
+    cli();
+    OCR1A = TIMER_TOP(rate);
+    TCNT1 = 0;
+    SREG = sreg;
+
+    return 1;
+}
+
+/* play a sound effect over the song (see synth_play_sfx) */
+/* returns 0 if one of higher priority is playing */
+uint8_t playback_play_sfx(uint32_t addr)
+{
+    return synth_play_sfx(addr);
+}
+
+/* move playback forward or back by a number of frames */
+/* Only the keyframe before the target is restored here. The frames */
+/* from there on are replayed by render_chunk, SEEK_CHUNK_FRAMES in */
+/* place of each chunk, which is silent meanwhile, since replaying */
+/* them all at once would take far longer than the ring holds. */
+void playback_seek(int16_t frames)
+{
+    int32_t target = (int32_t) synth_get_frame() + frames;
+    uint16_t start;
+
+    if (target < 0)
+        target = 0;
+    if (target > 0xFFFF)
+        target = 0xFFFF;
+
+    /* the rest of a partly rendered frame is dropped */
+    start = synth_seek_keyframe(target);
+    frame_left = 0;
+
+    seek_left = target - start;
+    if (seek_left > SYNTH_MAX_REPLAY)
+        seek_left = SYNTH_MAX_REPLAY;
+}
+
+/* record the time spent on a finished frame */
+static void end_frame(void)
+{
+    last_ticks = frame_ticks;
+    if (frame_ticks > max_ticks)
+    {
+        max_ticks = frame_ticks;
+        max_frame = stats_frame;
+    }
+    /* average over roughly the last 16 frames, taking out a 16th */
+    /* before adding the new frame so that it settles at 16 times */
+    /* the frame time */
+    avg_ticks16 -= avg_ticks16 >> 4;
+    avg_ticks16 += frame_ticks;
+
+    frame_ticks = 0;
+}
+
+/* cycles per frame at the current rates */
+static uint32_t frame_cycles(void)
 {
-    song_start = song_repeat = song_pos = addr;
+    return (uint32_t) synth_samples_per_frame() * (OCR1A + 1);
 }
 
-void playback_process_frame(void)
+static uint8_t load_percent(uint32_t cycles)
 {
-    uint8_t *out;
+    uint32_t load = cycles * 100 / frame_cycles();
 
-    /* write to buffer that isn't currently being played */
-    /* NOTE: though out_idx is modified in the isr, single byte */
-    /* accesses are inherently atomic so this is safe */
-    /* additionally, this function should only ever be called */
-    /* immediately after out_idx is modified (after buffer swap) */
-    out = outbuf[1 - out_idx];
+    return (load > 255) ? 255 : load;
+}
+
+void playback_get_stats(struct playback_stats *stats)
+{
+    stats->cycles = (uint32_t) last_ticks * STATS_PRESCALE;
+    stats->max_cycles = (uint32_t) max_ticks * STATS_PRESCALE;
+    stats->avg_cycles = (avg_ticks16 >> 4) * STATS_PRESCALE;
+    stats->load = load_percent(stats->cycles);
+    stats->max_load = load_percent(stats->max_cycles);
+    stats->avg_load = load_percent(stats->avg_cycles);
+    stats->max_frame = max_frame;
+    stats->underruns = underruns;
+    stats->idle_cycles = idle_total * STATS_PRESCALE;
+    stats->idle = idle_percent;
+}
+
+void playback_reset_stats(void)
+{
+    last_ticks = max_ticks = 0;
+    avg_ticks16 = 0;
+    max_frame = 0;
+    underruns = 0;
+}
+
+static void render_chunk(uint8_t *out)
+{
+    uint16_t left = CHUNK_SIZE;
+
+    /* carry on with a seek, which skips the noise lfsr like fast */
+    /* forwarding, since the exact replay would cost per sample */
+    if (seek_left)
+    {
+        uint8_t i;
+
+        for (i = 0; i < SEEK_CHUNK_FRAMES && seek_left; i++)
+        {
+            synth_skip_frame();
+            seek_left--;
+        }
+
+        memset(out, 0x80, CHUNK_SIZE * SAMPLE_BYTES);
+        return;
+    }
 
     /* if not playing, output silence */
-    if (state != PLAYBACK_STATE_PLAYING || !song_start || !song_pos)
+    if (state != PLAYBACK_STATE_PLAYING &&
+        state != PLAYBACK_STATE_FAST_FORWARD)
     {
-        memset(out, 0x80, SAMPLES_PER_FRAME);
+        memset(out, 0x80, CHUNK_SIZE * SAMPLE_BYTES);
         return;
     }
 
-    /* process all events for this frame */
-    while ((last_frame + pgm_read_byte_far(song_pos)) == frame)
+    while (left)
     {
-        uint8_t command, channel;
+        uint16_t count;
+
+        /* events are still processed once per frame, */
+        /* which may be in the middle of a chunk */
+        if (!frame_left)
+        {
+            uint16_t start;
+
+            BENCH_MARK(BENCH_FRAME_START);
+            start = TCNT3;
+            end_frame();
+
+            /* when fast forwarding, the frames in between */
+            /* only have their events applied */
+            if (state == PLAYBACK_STATE_FAST_FORWARD)
+            {
+                uint8_t i;
+
+                for (i = 1; i < speed; i++)
+                    synth_skip_frame();
+            }
+
+            if (!synth_process_events())
+            {
+                memset(out, 0x80, left * SAMPLE_BYTES);
+                return;
+            }
+
+            BENCH_MARK(BENCH_DECODE_END);
+            stats_frame = synth_get_frame() - 1;
+            frame_ticks += TCNT3 - start;
 
-        song_pos++;
-        command = pgm_read_byte_far(song_pos++);
-        channel = command & 0x0F;
-        switch (command & 0xF0)
+            frame_left = synth_samples_per_frame();
+        }
+
+        count = (left < frame_left) ? left : frame_left;
+
+        BENCH_MARK(BENCH_RENDER_START);
         {
-            /* step (frequency) */
-            case 0x00:
-                step[channel] = pgm_read_byte_far(song_pos++);
-                step[channel] |= pgm_read_byte_far(song_pos++) << 8;
-                break;
-            /* volume */
-            case 0x10:
-                volume[channel] = pgm_read_byte_far(song_pos++);
-                break;
-            /* duty cycle (square wave only) */
-            case 0x30:
-                duty[channel] = pgm_read_byte_far(song_pos++);
-                break;
-            /* noise channel mode */
-            case 0x40:
-                lfsr_mode = pgm_read_byte_far(song_pos++);
-                break;
-            /* set repeat point */
-            case 0xE0:
-                song_repeat = song_pos;
-                break;
-            /* jump to repeat point */
-            case 0xF0:
-                song_pos = song_repeat;
-                break;
-            default:
-                break;
+            uint16_t start = TCNT3;
+
+            synth_render(out, count);
+            frame_ticks += TCNT3 - start;
         }
+        BENCH_MARK(BENCH_RENDER_END);
 
-        last_frame = frame;
+        out += count * SAMPLE_BYTES;
+        left -= count;
+        frame_left -= count;
     }
+}
+
+/* close the idle window once it is long enough */
+static void update_idle(void)
+{
+    uint16_t now = TCNT3;
 
-    /* calculate this frame */
-    calculate_frame(out);
+    /* this runs at least once per chunk, so the timer can't wrap */
+    /* more than once in between */
+    window_ticks += (uint16_t) (now - window_last);
+    window_last = now;
 
-    /* increment frame count */
-    frame++;
+    if (window_ticks >= IDLE_WINDOW)
+    {
+        idle_percent = idle_ticks * 100 / window_ticks;
+        idle_ticks = 0;
+        window_ticks = 0;
+    }
 }
 
-void wait_vblank(void)
+void playback_update(void)
 {
-    /* wait for next frame (buffer swap) */
-    while (!vblank);
+    uint8_t played = chunks_played;
+
+    update_idle();
+
+    /* If the interrupt has caught up with the rendering, it is */
+    /* playing a chunk that was never rendered again. That chunk is */
+    /* lost, so rendering carries on with the one after it, which */
+    /* also keeps the counts from looking like a full ring. */
+    if ((uint8_t) (chunks_rendered - played - 1) >= NUM_CHUNKS)
+    {
+        uint8_t skip = played + 1 - chunks_rendered;
+
+        underruns++;
+        chunks_rendered += skip;
+        fill_idx = (fill_idx + skip) % NUM_CHUNKS;
+    }
+
+    /* render every chunk the interrupt has finished playing */
+    /* NOTE: chunks_played is only written by the isr and */
+    /* chunks_rendered only here, and single byte accesses */
+    /* are inherently atomic, so no locking is needed */
+    while ((uint8_t) (chunks_rendered - chunks_played) < NUM_CHUNKS)
+    {
+        render_chunk(outbuf + fill_idx * CHUNK_SIZE * SAMPLE_BYTES);
+
+        if (++fill_idx == NUM_CHUNKS)
+            fill_idx = 0;
+        chunks_rendered++;
+    }
+}
+
+void playback_wait(void)
+{
+    /* wait until a chunk is free, using the time to */
+    /* decode upcoming song events ahead of time */
+    while ((uint8_t) (chunks_rendered - chunks_played) == NUM_CHUNKS)
+    {
+        uint16_t start, slept;
+
+        if (synth_prefetch())
+            continue;
+
+        /* Once the event queue is full there is nothing left to do, */
+        /* so sleep until the next interrupt. The check is repeated */
+        /* with interrupts off, since a chunk finishing in between */
+        /* would otherwise go unnoticed until the one after it. sei */
+        /* always runs the next instruction before any interrupt, so */
+        /* the sleep can't miss it either. */
+        cli();
+        if ((uint8_t) (chunks_rendered - chunks_played) != NUM_CHUNKS)
+        {
+            sei();
+            break;
+        }
+        start = TCNT3;
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+        /* this includes the interrupt which woke it up */
+        slept = TCNT3 - start;
+        idle_ticks += slept;
+        idle_total += slept;
+    }
 }
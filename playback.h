@@ -3,25 +3,71 @@
    Purpose: Contains prototypes for all audio playback related routines
 */
 
-#include <stdint.h>
-
 #ifndef PLAYBACK_H
 #define PLAYBACK_H
 
+/* output is rendered into a ring of NUM_CHUNKS chunks of CHUNK_SIZE */
+/* samples, which the interrupt plays back one after another */
+#ifndef CHUNK_SIZE
+#define CHUNK_SIZE 112
+#endif
+#ifndef NUM_CHUNKS
+#define NUM_CHUNKS 4
+#endif
+
+/* the constants above are also used by the assembly interrupt */
+#ifndef __ASSEMBLER__
+
+#include <stdint.h>
+
 enum
 {
     PLAYBACK_STATE_STOPPED = 0,
     PLAYBACK_STATE_PLAYING,
-    PLAYBACK_STATE_PAUSED
+    PLAYBACK_STATE_PAUSED,
+    PLAYBACK_STATE_FAST_FORWARD
+};
+
+/* fastest fast forward, in song frames per output frame */
+#define PLAYBACK_MAX_SPEED 16
+
+/* timing of playback, for finding songs close to the limit */
+/* loads are percentages of a frame's time, and can pass 100 */
+struct playback_stats
+{
+    /* CPU cycles spent decoding and rendering the last frame, */
+    /* the most spent on any frame, and the recent average */
+    uint32_t cycles;
+    uint32_t max_cycles;
+    uint32_t avg_cycles;
+    uint8_t load;
+    uint8_t max_load;
+    uint8_t avg_load;
+    /* song frame which took max_cycles */
+    uint16_t max_frame;
+    /* output chunks played before they were rendered */
+    uint16_t underruns;
+    /* CPU cycles spent asleep waiting for a free chunk (wraps), */
+    /* and the percentage of recent time spent so */
+    uint32_t idle_cycles;
+    uint8_t idle;
 };
 
 void playback_init(void);
 void playback_stop(void);
 void playback_play(void);
 void playback_pause(void);
+void playback_fast_forward(uint8_t frames);
 uint8_t playback_get_state(void);
-void playback_set_song(uint32_t addr);
-void playback_process_frame(void);
-void wait_vblank(void);
+void playback_set_song(uint32_t addr, uint32_t keyframes);
+uint8_t playback_set_rate(uint16_t rate, uint8_t fps);
+void playback_seek(int16_t frames);
+uint8_t playback_play_sfx(uint32_t addr);
+void playback_update(void);
+void playback_wait(void);
+void playback_get_stats(struct playback_stats *stats);
+void playback_reset_stats(void);
+
+#endif /* __ASSEMBLER__ */
 
 #endif /* PLAYBACK_H */
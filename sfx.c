@@ -0,0 +1,54 @@
+/* File:    sfx.c
+   Author:  Frank Dischner
+   Purpose: Contains the sound effect data, which are short event streams
+            played over the song (see synth_play_sfx)
+*/
+
+#include <stdint.h>
+#include "platform.h"
+#include "synth.h"
+#include "sfx.h"
+
+/* steps are for the songs' 40kHz, like a song's (see synth.h) */
+
+/* two rising notes on the second square, the second fading out */
+static const prog_uint8_t coin_data[] =
+{
+    SYNTH_SFX_HEADER(0x02, 1),
+    /* 25% duty, B5 at volume 12 */
+    0x00, 0x31, 0x40,
+    0x00, 0x01, 0x53, 0x06,
+    0x00, 0x11, 0x0C,
+    /* E6 after 4 frames, fading by 1 every 2 frames */
+    0x04, 0x01, 0x71, 0x08,
+    0x00, 0x51, 0xFC, 0xC2,
+    /* done once it's silent */
+    0x18, 0xF0
+};
+
+/* a burst of noise, falling in pitch as it fades out */
+static const prog_uint8_t hit_data[] =
+{
+    SYNTH_SFX_HEADER(0x08, 2),
+    /* long mode */
+    0x00, 0x43, 0x00,
+    /* sweeping down by 0x80 every frame */
+    0x00, 0x73, 0x00, 0x20, 0x80, 0xF1,
+    /* from volume 15, fading by 1 every 2 frames */
+    0x00, 0x53, 0xFF, 0xF2,
+    0x1E, 0xF0
+};
+
+static uint32_t effects[NUM_SFX];
+
+void sfx_init(void)
+{
+    /* far addresses, as for the songs (see songs.c) */
+    effects[SFX_COIN] = platform_far_address(coin_data);
+    effects[SFX_HIT] = platform_far_address(hit_data);
+}
+
+uint32_t sfx_data(uint8_t index)
+{
+    return effects[index];
+}
@@ -0,0 +1,22 @@
+/* File:    sfx.h
+   Author:  Frank Dischner
+   Purpose: Contains prototypes for the sound effect routines
+*/
+
+#include <stdint.h>
+#include "platform.h"
+
+#ifndef SFX_H
+#define SFX_H
+
+enum
+{
+    SFX_COIN = 0,
+    SFX_HIT,
+    NUM_SFX
+};
+
+void sfx_init(void);
+uint32_t sfx_data(uint8_t index);
+
+#endif /* SFX_H */
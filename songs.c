@@ -5,61 +5,143 @@
 */
 
 #include <stdint.h>
-#include <avr/pgmspace.h>
+#include "platform.h"
+#include "synth.h"
 
 struct song
 {
     uint32_t data;
+    uint32_t keyframes;
     uint32_t name;
 };
 
-#define NUM_SONGS 9
+#define NUM_SONGS 11
 
 /* include all the song data */
+/* the songs are packed from the .inc files when building, */
+/* slides are turned into envelopes and sweeps first (see */
+/* host/envpack.c), then they are either compressed (lz, see */
+/* lz.h) or have repeated runs of events factored out (pat, */
+/* see host/patpack.c) */
+#ifndef SONG_FORMAT
+#define SONG_FORMAT lz
+#define SONG_FLAGS  SONG_COMPRESSED
+#endif
+
+#define STR(x) #x
+#define XSTR(x) STR(x)
+#define SONG_FILE(name) XSTR(name.SONG_FORMAT.inc)
+/* each song also has a seek index (see synth.h) */
+#define SEEK_FILE(name) XSTR(name.SONG_FORMAT.seek.inc)
 
 static const prog_uint8_t castlevania_data[] =
 {
-#include "cv.inc"
+#include SONG_FILE(cv)
+};
+
+static const prog_uint8_t castlevania_keyframes[] =
+{
+#include SEEK_FILE(cv)
 };
 
 static const prog_uint8_t castlevania2_data[] =
 {
-#include "cv2.inc"
+#include SONG_FILE(cv2)
+};
+
+static const prog_uint8_t castlevania2_keyframes[] =
+{
+#include SEEK_FILE(cv2)
 };
 
 static const prog_uint8_t ducktales_data[] =
 {
-#include "dtmoon.inc"
+#include SONG_FILE(dtmoon)
+};
+
+static const prog_uint8_t ducktales_keyframes[] =
+{
+#include SEEK_FILE(dtmoon)
 };
 
 static const prog_uint8_t smb1_data[] =
 {
-#include "smb1.inc"
+#include SONG_FILE(smb1)
+};
+
+static const prog_uint8_t smb1_keyframes[] =
+{
+#include SEEK_FILE(smb1)
 };
 
 static const prog_uint8_t smb3_data[] =
 {
-#include "smb3.inc"
+#include SONG_FILE(smb3)
+};
+
+static const prog_uint8_t smb3_keyframes[] =
+{
+#include SEEK_FILE(smb3)
 };
 
 static const prog_uint8_t tetris1_data[] =
 {
-#include "tetris1.inc"
+#include SONG_FILE(tetris1)
+};
+
+static const prog_uint8_t tetris1_keyframes[] =
+{
+#include SEEK_FILE(tetris1)
 };
 
 static const prog_uint8_t tetris2_data[] =
 {
-#include "tetris2.inc"
+#include SONG_FILE(tetris2)
+};
+
+static const prog_uint8_t tetris2_keyframes[] =
+{
+#include SEEK_FILE(tetris2)
 };
 
 static const prog_uint8_t tetris3_data[] =
 {
-#include "tetris3.inc"
+#include SONG_FILE(tetris3)
+};
+
+static const prog_uint8_t tetris3_keyframes[] =
+{
+#include SEEK_FILE(tetris3)
 };
 
 static const prog_uint8_t zelda_data[] =
 {
-#include "zelda.inc"
+#include SONG_FILE(zelda)
+};
+
+static const prog_uint8_t zelda_keyframes[] =
+{
+#include SEEK_FILE(zelda)
+};
+
+static const prog_uint8_t ducktales2_data[] =
+{
+#include SONG_FILE(dtmine)
+};
+
+static const prog_uint8_t ducktales2_keyframes[] =
+{
+#include SEEK_FILE(dtmine)
+};
+
+static const prog_uint8_t megaman_data[] =
+{
+#include SONG_FILE(mm)
+};
+
+static const prog_uint8_t megaman_keyframes[] =
+{
+#include SEEK_FILE(mm)
 };
 
 static struct song songs[NUM_SONGS];
@@ -75,33 +157,50 @@ static const prog_char tetris1_str[] = "Tetris          Theme A";
 static const prog_char tetris2_str[] = "Tetris          Theme B";
 static const prog_char tetris3_str[] = "Tetris          Theme C";
 static const prog_char ducktales_str[] = "Ducktales       The Moon";
+static const prog_char ducktales2_str[] = "Ducktales       African Mines";
+static const prog_char megaman_str[] = "Mega Man";
 
 void songs_init(void)
 {
     /* fill the song structs with pointers to the data */
     /* we have to do this in a function because avr-gcc */
     /* only supports 16-bit pointers, so it can only address */
-    /* up to 64K. Using the pgm_get_far_address macro gives us */
+    /* up to 64K. Using the platform_far_address macro gives us */
     /* a pseudo 32-bit pointer, which allows us to access all */
     /* 128K of program memory using the pgm_read_*_far functions */
-    songs[0].data = pgm_get_far_address(smb1_data);
-    songs[0].name = pgm_get_far_address(smb1_str);
-    songs[1].data = pgm_get_far_address(zelda_data);
-    songs[1].name = pgm_get_far_address(zelda_str);
-    songs[2].data = pgm_get_far_address(castlevania_data);
-    songs[2].name = pgm_get_far_address(castlevania_str);
-    songs[3].data = pgm_get_far_address(castlevania2_data);
-    songs[3].name = pgm_get_far_address(castlevania2_str);
-    songs[4].data = pgm_get_far_address(smb3_data);
-    songs[4].name = pgm_get_far_address(smb3_str);
-    songs[5].data = pgm_get_far_address(tetris1_data);
-    songs[5].name = pgm_get_far_address(tetris1_str);
-    songs[6].data = pgm_get_far_address(tetris2_data);
-    songs[6].name = pgm_get_far_address(tetris2_str);
-    songs[7].data = pgm_get_far_address(tetris3_data);
-    songs[7].name = pgm_get_far_address(tetris3_str);
-    songs[8].data = pgm_get_far_address(ducktales_data);
-    songs[8].name = pgm_get_far_address(ducktales_str);
+    songs[0].data = platform_far_address(smb1_data) | SONG_FLAGS;
+    songs[0].keyframes = platform_far_address(smb1_keyframes);
+    songs[0].name = platform_far_address(smb1_str);
+    songs[1].data = platform_far_address(zelda_data) | SONG_FLAGS;
+    songs[1].keyframes = platform_far_address(zelda_keyframes);
+    songs[1].name = platform_far_address(zelda_str);
+    songs[2].data = platform_far_address(castlevania_data) | SONG_FLAGS;
+    songs[2].keyframes = platform_far_address(castlevania_keyframes);
+    songs[2].name = platform_far_address(castlevania_str);
+    songs[3].data = platform_far_address(castlevania2_data) | SONG_FLAGS;
+    songs[3].keyframes = platform_far_address(castlevania2_keyframes);
+    songs[3].name = platform_far_address(castlevania2_str);
+    songs[4].data = platform_far_address(smb3_data) | SONG_FLAGS;
+    songs[4].keyframes = platform_far_address(smb3_keyframes);
+    songs[4].name = platform_far_address(smb3_str);
+    songs[5].data = platform_far_address(tetris1_data) | SONG_FLAGS;
+    songs[5].keyframes = platform_far_address(tetris1_keyframes);
+    songs[5].name = platform_far_address(tetris1_str);
+    songs[6].data = platform_far_address(tetris2_data) | SONG_FLAGS;
+    songs[6].keyframes = platform_far_address(tetris2_keyframes);
+    songs[6].name = platform_far_address(tetris2_str);
+    songs[7].data = platform_far_address(tetris3_data) | SONG_FLAGS;
+    songs[7].keyframes = platform_far_address(tetris3_keyframes);
+    songs[7].name = platform_far_address(tetris3_str);
+    songs[8].data = platform_far_address(ducktales_data) | SONG_FLAGS;
+    songs[8].keyframes = platform_far_address(ducktales_keyframes);
+    songs[8].name = platform_far_address(ducktales_str);
+    songs[9].data = platform_far_address(ducktales2_data) | SONG_FLAGS;
+    songs[9].keyframes = platform_far_address(ducktales2_keyframes);
+    songs[9].name = platform_far_address(ducktales2_str);
+    songs[10].data = platform_far_address(megaman_data) | SONG_FLAGS;
+    songs[10].keyframes = platform_far_address(megaman_keyframes);
+    songs[10].name = platform_far_address(megaman_str);
 }
 
 uint32_t cur_song_data(void)
@@ -109,11 +208,21 @@ uint32_t cur_song_data(void)
     return (uint32_t) songs[song_idx].data;
 }
 
+uint32_t cur_song_keyframes(void)
+{
+    return songs[song_idx].keyframes;
+}
+
 uint32_t cur_song_name(void)
 {
     return songs[song_idx].name;
 }
 
+uint8_t num_songs(void)
+{
+    return NUM_SONGS;
+}
+
 uint32_t next_song(void)
 {
     if (++song_idx >= NUM_SONGS)
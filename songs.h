@@ -4,14 +4,16 @@
 */
 
 #include <stdint.h>
-#include <avr/pgmspace.h>
+#include "platform.h"
 
 #ifndef SONG_H
 #define SONG_H
 
 void songs_init(void);
 uint32_t cur_song_data(void);
+uint32_t cur_song_keyframes(void);
 uint32_t cur_song_name(void);
+uint8_t num_songs(void);
 uint32_t next_song(void);
 uint32_t prev_song(void);
 
@@ -0,0 +1,1329 @@
+/* File:    synth.c
+   Author:  Frank Dischner
+   Purpose: Contains implementations of the hardware independent synthesis
+            core, which decodes song events and renders samples
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include "platform.h"
+#include "synth.h"
+#include "lz.h"
+
+/* state needed for wave generation */
+/* step is scaled from the song's step for the output rate */
+static uint16_t step[4] = { 0, 0, 0, 0 };
+static uint16_t song_step[4] = { 0, 0, 0, 0 };
+static int8_t volume[4] = { 0, 0, 0, 0 };
+static uint8_t duty[2] = { 0x80, 0x80 };
+static uint16_t phase[4] = { 0, 0, 0, 0 };
+static uint16_t lfsr = 1;
+static uint8_t lfsr_mode = 0;
+/* pan settings (see synth.h), only used by stereo builds but */
+/* tracked by all of them, which start with the squares apart */
+#define DEFAULT_PAN \
+    { SYNTH_PAN(8, 5), SYNTH_PAN(5, 8), SYNTH_PAN_CENTER, SYNTH_PAN_CENTER }
+static const uint8_t default_pan[4] = DEFAULT_PAN;
+static uint8_t pan[4] = DEFAULT_PAN;
+
+#ifdef BLEP
+/* Band-limited edges. The hard switch of a square or noise channel */
+/* between two levels aliases, which is heard as inharmonic tones on */
+/* high notes. Each edge is instead spread over the sample it falls */
+/* before and the one after, as a polynomial band-limited step, whose */
+/* residuals depend on how far the edge is between the two samples. */
+/* This delays the channel by one sample, and only costs anything at */
+/* the edges themselves. */
+
+/* residuals in 1/64ths of the edge's height, by how far the first */
+/* sample after the edge is past it, t, in 1/16ths of a sample */
+/* added to that sample, which still has the old level: t^2 / 2 */
+static const uint8_t blep_first[16] =
+{
+    0, 0, 1, 2, 3, 4, 5, 7, 9, 11, 14, 17, 20, 23, 26, 30
+};
+/* taken from the next one, which has the new level: (1 - t)^2 / 2 */
+/* residuals are rounded toward zero, so the output never leaves the */
+/* range between the two levels, even with an edge on each sample */
+static const uint8_t blep_next[16] =
+{
+    30, 26, 23, 20, 17, 14, 11, 9, 7, 5, 4, 3, 2, 1, 0, 0
+};
+
+/* residual of an edge on the last sample rendered for each channel, */
+/* left for its next sample, as the blep_next entry of the edge, */
+/* negated if the edge went to the low level */
+static int8_t blep_carry[4] = { 0, 0, 0, 0 };
+#endif /* BLEP */
+
+#ifdef NES_MIXER
+/* The console mixes the two square channels and the triangle and noise */
+/* channels through separate nonlinear DACs, so each group is summed on */
+/* its own and looked up in a table. A channel's level is 0 to its */
+/* volume, instead of the negative to positive volume of the linear mix. */
+/* The tables map the loudest mix to 0xFF80 and silence to 0x8080, so */
+/* the high byte stays centered on the usual 0x80 and is rounded. */
+
+/* by square sum n (0-30): 95.52 / (8128 / n + 100) */
+static const uint16_t pulse_table[31] =
+{
+    0x0000, 0x0245, 0x047C, 0x06A6, 0x08C2, 0x0AD3, 0x0CD7, 0x0ECF,
+    0x10BC, 0x129E, 0x1475, 0x1643, 0x1806, 0x19C0, 0x1B71, 0x1D18,
+    0x1EB7, 0x204E, 0x21DC, 0x2362, 0x24E1, 0x2658, 0x27C8, 0x2930,
+    0x2A92, 0x2BEE, 0x2D43, 0x2E91, 0x2FD9, 0x311C, 0x3259
+};
+
+/* by triangle level (0-64) plus 3 times the noise volume, which is */
+/* close to the console's weights of 3 per triangle step and 2 per */
+/* noise step: 163.67 / (24329 / (n * 45 / 64) + 100) */
+static const uint16_t tnd_table[110] =
+{
+    0x8080, 0x816C, 0x8257, 0x8340, 0x8428, 0x850F, 0x85F4, 0x86D8,
+    0x87BB, 0x889D, 0x897D, 0x8A5C, 0x8B3A, 0x8C16, 0x8CF2, 0x8DCC,
+    0x8EA5, 0x8F7C, 0x9053, 0x9128, 0x91FC, 0x92CF, 0x93A1, 0x9472,
+    0x9541, 0x9610, 0x96DD, 0x97A9, 0x9875, 0x993F, 0x9A08, 0x9AD0,
+    0x9B97, 0x9C5C, 0x9D21, 0x9DE5, 0x9EA8, 0x9F69, 0xA02A, 0xA0EA,
+    0xA1A9, 0xA266, 0xA323, 0xA3DF, 0xA49A, 0xA553, 0xA60C, 0xA6C4,
+    0xA77B, 0xA832, 0xA8E7, 0xA99B, 0xAA4E, 0xAB01, 0xABB2, 0xAC63,
+    0xAD13, 0xADC2, 0xAE70, 0xAF1D, 0xAFCA, 0xB075, 0xB120, 0xB1CA,
+    0xB273, 0xB31B, 0xB3C2, 0xB469, 0xB50F, 0xB5B3, 0xB658, 0xB6FB,
+    0xB79E, 0xB83F, 0xB8E1, 0xB981, 0xBA20, 0xBABF, 0xBB5D, 0xBBFA,
+    0xBC97, 0xBD33, 0xBDCE, 0xBE68, 0xBF02, 0xBF9B, 0xC033, 0xC0CB,
+    0xC161, 0xC1F8, 0xC28D, 0xC322, 0xC3B6, 0xC449, 0xC4DC, 0xC56E,
+    0xC5FF, 0xC690, 0xC720, 0xC7B0, 0xC83E, 0xC8CD, 0xC95A, 0xC9E7,
+    0xCA73, 0xCAFF, 0xCB8A, 0xCC14, 0xCC9E, 0xCD27
+};
+
+/* samples mixed at once, with the triangle and noise channels */
+/* rendered into a buffer of their own */
+#define MIX_BLOCK 128
+
+static uint8_t tnd_buf[MIX_BLOCK];
+#endif /* NES_MIXER */
+
+/* song steps are scaled by step_scale / STEP_SCALE_ONE */
+#define STEP_SCALE_SHIFT 14
+#define STEP_SCALE_ONE   (1U << STEP_SCALE_SHIFT)
+#define STEP_SCALE(rate) \
+    ((uint16_t) ((((uint32_t) SONG_SAMPLE_RATE << STEP_SCALE_SHIFT) + \
+                  (rate) / 2) / (rate)))
+
+static uint16_t sample_rate = SAMPLE_RATE;
+static uint8_t frame_rate = FRAME_RATE;
+static uint16_t samples_per_frame = SAMPLES_PER_FRAME;
+static uint16_t step_scale = STEP_SCALE(SAMPLE_RATE);
+
+/* envelope and sweep units, which step a channel's volume or step */
+/* by delta every period frames, so songs don't need to write each */
+/* new value themselves */
+struct unit
+{
+    int8_t delta;
+    uint8_t period;
+    uint8_t timer;
+    /* steps left, the unit is stopped when this is zero */
+    uint8_t steps;
+};
+
+static struct unit envelope[4];
+static struct unit sweep[4];
+/* frames until a channel is silenced, or zero if not counting */
+static uint8_t length[4];
+/* 'pointers' to song info */
+static uint32_t song_start = 0;
+static uint32_t song_repeat = 0;
+static uint32_t song_pos = 0;
+/* set if the song data is compressed, in which case */
+/* the pointers above refer to the compressed data */
+static uint8_t song_compressed = 0;
+static struct lz lz;
+
+/* return addresses and loop counts for pattern events */
+/* these are only used by uncompressed songs (see host/patpack.c) */
+struct pattern_level
+{
+    uint32_t pos;
+    uint8_t count;
+};
+
+#define PATTERN_DEPTH 4
+
+static struct pattern_level patterns[PATTERN_DEPTH];
+static uint8_t pattern_level = 0;
+/* current frame */
+static uint16_t frame = 0;
+/* last frame containing a decoded event */
+static uint16_t last_frame = 0;
+
+/* decoder state just after the last keyframe point, */
+/* or a zero position if none was decoded yet */
+static uint32_t sync_pos = 0;
+static uint16_t sync_frame = 0;
+/* seek index of the current song, or 0 if it has none */
+static uint32_t keyframes = 0;
+
+/* events are decoded ahead of time into a queue, so that applying */
+/* them at the start of a frame doesn't need any program memory reads */
+struct event
+{
+    uint16_t frame;
+    uint8_t command;
+    uint16_t value;
+    /* extra operands of envelope and sweep events */
+    uint16_t arg;
+};
+
+/* must be a power of two */
+#define EVENT_QUEUE_SIZE 32
+
+static struct event queue[EVENT_QUEUE_SIZE];
+/* index of next event to apply */
+static uint8_t queue_head = 0;
+/* number of decoded events waiting to be applied */
+static uint8_t queue_count = 0;
+
+/* the state of a channel which is kept aside while another stream */
+/* plays on it (see synth_play_sfx) */
+struct channel_state
+{
+    uint16_t step;
+    uint16_t song_step;
+    int8_t volume;
+    /* duty cycle of a square, or the mode of the noise channel */
+    uint8_t mode;
+    uint8_t pan;
+    uint8_t length;
+    struct unit envelope;
+    struct unit sweep;
+};
+
+/* sound effect position, or 0 if none is playing */
+static uint32_t sfx_pos = 0;
+/* frames until its next event */
+static uint8_t sfx_wait;
+/* its priority and channels, as in its header */
+static uint8_t sfx_priority;
+static uint8_t sfx_channels = 0;
+/* the song's state of each channel taken by the effect */
+static struct channel_state song_channels[4];
+
+void synth_reset(void)
+{
+    /* reset output state */
+    step[0] = step[1] = step[2] = step[3] = 0;
+    song_step[0] = song_step[1] = song_step[2] = song_step[3] = 0;
+    volume[0] = volume[1] = volume[2] = volume[3] = 0;
+    duty[0] = duty[1] = 0x80;
+    phase[0] = phase[1] = phase[2] = phase[3] = 0;
+    lfsr = 1;
+    lfsr_mode = 0;
+    memcpy(pan, default_pan, sizeof(pan));
+#ifdef BLEP
+    memset(blep_carry, 0, sizeof(blep_carry));
+#endif
+    memset(envelope, 0, sizeof(envelope));
+    memset(sweep, 0, sizeof(sweep));
+    memset(length, 0, sizeof(length));
+    frame = last_frame = 0;
+    queue_head = queue_count = 0;
+    pattern_level = 0;
+    sync_pos = 0;
+    sfx_channels = 0;
+    sfx_pos = 0;
+
+    /* reset song to beginning */
+    song_pos = song_repeat = song_start;
+    lz_seek(&lz, song_start);
+}
+
+void synth_set_song(uint32_t addr)
+{
+    song_compressed = (addr & SONG_COMPRESSED) ? 1 : 0;
+    addr &= ~SONG_COMPRESSED;
+    song_start = song_repeat = song_pos = addr;
+    lz_seek(&lz, addr);
+    frame = last_frame = 0;
+    queue_head = queue_count = 0;
+    pattern_level = 0;
+    sync_pos = 0;
+    keyframes = 0;
+    sfx_channels = 0;
+    sfx_pos = 0;
+}
+
+void synth_set_keyframes(uint32_t addr)
+{
+    keyframes = addr;
+}
+
+/* scale a song step to the output rate */
+static uint16_t scale_step(uint16_t value)
+{
+    uint32_t scaled;
+
+    /* songs are normally played at the rate they were written for */
+    if (step_scale == STEP_SCALE_ONE)
+        return value;
+
+    scaled = ((uint32_t) value * step_scale + (STEP_SCALE_ONE >> 1)) >>
+             STEP_SCALE_SHIFT;
+
+    /* only steps far above what a lower rate can reproduce overflow */
+    return (scaled > 0xFFFF) ? 0xFFFF : scaled;
+}
+
+static void set_step(uint8_t channel, uint16_t value)
+{
+    song_step[channel] = value;
+    step[channel] = scale_step(value);
+}
+
+/* change the output rate and the frames per second, which applies */
+/* from the next frame on, since the current one may be partly */
+/* rendered already */
+/* returns 0 if either is out of range, leaving both unchanged */
+uint8_t synth_set_rate(uint16_t rate, uint8_t fps)
+{
+    uint8_t i;
+
+    if (rate < MIN_SAMPLE_RATE || rate > MAX_SAMPLE_RATE ||
+        fps < FRAME_RATE_PAL || fps > FRAME_RATE_NTSC)
+        return 0;
+
+    sample_rate = rate;
+    frame_rate = fps;
+    samples_per_frame = SAMPLES_PER_FRAME_AT(rate, fps);
+    step_scale = STEP_SCALE(rate);
+
+    /* the song's state of any channels a sound effect has */
+    /* taken is rescaled too, for when it gets them back */
+    for (i = 0; i < 4; i++)
+    {
+        step[i] = scale_step(song_step[i]);
+        if (sfx_channels & (1 << i))
+            song_channels[i].step = scale_step(song_channels[i].song_step);
+    }
+
+    return 1;
+}
+
+uint16_t synth_get_rate(void)
+{
+    return sample_rate;
+}
+
+uint8_t synth_get_frame_rate(void)
+{
+    return frame_rate;
+}
+
+uint16_t synth_samples_per_frame(void)
+{
+    return samples_per_frame;
+}
+
+uint16_t synth_get_frame(void)
+{
+    return frame;
+}
+
+/* read the next byte of song data */
+static uint8_t song_read_byte(void)
+{
+    if (song_compressed)
+        return lz_read_byte(&lz);
+
+    return platform_read_byte(song_pos++);
+}
+
+/* decode the next song event into the queue */
+/* returns 0 if the queue is full or there is no song */
+uint8_t synth_prefetch(void)
+{
+    struct event *e;
+    uint8_t command;
+
+    if (!song_start || !song_pos || queue_count == EVENT_QUEUE_SIZE)
+        return 0;
+
+    /* each event's frame is relative to the previous event */
+    last_frame += song_read_byte();
+    command = song_read_byte();
+
+    e = &queue[(queue_head + queue_count) & (EVENT_QUEUE_SIZE - 1)];
+    e->frame = last_frame;
+    e->command = command;
+
+    switch (command & 0xF0)
+    {
+        /* step (frequency) */
+        case 0x00:
+            e->value = song_read_byte();
+            e->value |= song_read_byte() << 8;
+            break;
+        /* volume */
+        case 0x10:
+        /* duty cycle (square wave only) */
+        case 0x30:
+        /* noise channel mode */
+        case 0x40:
+        /* pan */
+        case 0x80:
+            e->value = song_read_byte();
+            break;
+        /* envelope, with a length counter for 0x60 */
+        case 0x50:
+        case 0x60:
+            e->value = song_read_byte();
+            e->value |= song_read_byte() << 8;
+            e->arg = (command & 0x20) ? song_read_byte() : 0;
+            break;
+        /* sweep */
+        case 0x70:
+            e->value = song_read_byte();
+            e->value |= song_read_byte() << 8;
+            e->arg = song_read_byte();
+            e->arg |= song_read_byte() << 8;
+            break;
+        /* set repeat point */
+        /* this and the following events only affect decoding, */
+        /* so they aren't queued */
+        case 0xE0:
+            song_repeat = song_compressed ? lz_sync(&lz) : song_pos;
+            return 1;
+        /* keyframe point, which decoding can be restarted from */
+        /* (see host/seekgen.c) */
+        case 0x20:
+            sync_pos = song_compressed ? lz_sync(&lz) : song_pos;
+            sync_frame = last_frame;
+            return 1;
+        /* jump to repeat point */
+        case 0xF0:
+            song_pos = song_repeat;
+            lz_seek(&lz, song_repeat);
+            pattern_level = 0;
+            return 1;
+        /* loop start, repeats until the loop end count times */
+        case 0xA0:
+            command = song_read_byte();
+            if (pattern_level < PATTERN_DEPTH)
+            {
+                patterns[pattern_level].pos = song_pos;
+                patterns[pattern_level++].count = command;
+            }
+            return 1;
+        /* loop end */
+        case 0xB0:
+            if (pattern_level)
+            {
+                if (--patterns[pattern_level - 1].count)
+                    song_pos = patterns[pattern_level - 1].pos;
+                else
+                    pattern_level--;
+            }
+            return 1;
+        /* call pattern, given as an offset from the start of the song */
+        case 0xC0:
+            e->value = song_read_byte();
+            e->value |= song_read_byte() << 8;
+            if (pattern_level < PATTERN_DEPTH)
+            {
+                patterns[pattern_level].pos = song_pos;
+                patterns[pattern_level++].count = 0;
+                song_pos = song_start + e->value;
+            }
+            return 1;
+        /* return from pattern */
+        case 0xD0:
+            if (pattern_level)
+                song_pos = patterns[--pattern_level].pos;
+            return 1;
+        default:
+            return 1;
+    }
+
+    queue_count++;
+
+    return 1;
+}
+
+/* start a unit from the period and steps byte of an event */
+static void unit_start(struct unit *u, int8_t delta, uint8_t timing)
+{
+    u->delta = delta;
+    u->period = u->timer = timing & 0x0F;
+    u->steps = timing >> 4;
+}
+
+/* returns 1 if the unit's value should be stepped this frame */
+static uint8_t unit_clock(struct unit *u)
+{
+    if (!u->steps || --u->timer)
+        return 0;
+
+    u->timer = u->period;
+    u->steps--;
+
+    return 1;
+}
+
+/* step the units of the given channels (bit n for channel n) for */
+/* the frame, before its events are applied, so that any write from */
+/* the song overrides them */
+static void clock_units(uint8_t channels)
+{
+    uint8_t i;
+
+    for (i = 0; i < 4; i++, channels >>= 1)
+    {
+        if (!(channels & 0x1))
+            continue;
+        if (unit_clock(&envelope[i]))
+            volume[i] += envelope[i].delta;
+        if (unit_clock(&sweep[i]))
+            set_step(i, song_step[i] + sweep[i].delta);
+        if (length[i] && !--length[i])
+        {
+            volume[i] = 0;
+            envelope[i].steps = 0;
+        }
+    }
+}
+
+/* apply a decoded event to its channel */
+static void apply_event(const struct event *e)
+{
+    uint8_t channel = e->command & 0x0F;
+
+    switch (e->command & 0xF0)
+    {
+        /* step (frequency) */
+        case 0x00:
+            set_step(channel, e->value);
+            sweep[channel].steps = 0;
+            break;
+        /* volume */
+        case 0x10:
+            volume[channel] = e->value;
+            envelope[channel].steps = 0;
+            length[channel] = 0;
+            break;
+        /* duty cycle (square wave only) */
+        case 0x30:
+            duty[channel] = e->value;
+            break;
+        /* noise channel mode */
+        case 0x40:
+            lfsr_mode = e->value;
+            break;
+        /* pan, the gains of the left and right outputs */
+        case 0x80:
+            pan[channel] = e->value;
+            break;
+        /* envelope, starting at the volume in the low nibble */
+        case 0x50:
+        case 0x60:
+            volume[channel] = e->value & 0x0F;
+            unit_start(&envelope[channel], ((int8_t) e->value) >> 4,
+                       e->value >> 8);
+            length[channel] = e->arg;
+            break;
+        /* sweep, starting at the given step */
+        case 0x70:
+            set_step(channel, e->value);
+            unit_start(&sweep[channel], (int8_t) e->arg, e->arg >> 8);
+            break;
+        default:
+            break;
+    }
+}
+
+static void save_channel(uint8_t channel, struct channel_state *c)
+{
+    c->step = step[channel];
+    c->song_step = song_step[channel];
+    c->volume = volume[channel];
+    c->pan = pan[channel];
+    c->length = length[channel];
+    c->envelope = envelope[channel];
+    c->sweep = sweep[channel];
+    if (channel < 2)
+        c->mode = duty[channel];
+    else if (channel == 3)
+        c->mode = lfsr_mode;
+}
+
+static void load_channel(uint8_t channel, const struct channel_state *c)
+{
+    step[channel] = c->step;
+    song_step[channel] = c->song_step;
+    volume[channel] = c->volume;
+    pan[channel] = c->pan;
+    length[channel] = c->length;
+    envelope[channel] = c->envelope;
+    sweep[channel] = c->sweep;
+    if (channel < 2)
+        duty[channel] = c->mode;
+    else if (channel == 3)
+        lfsr_mode = c->mode;
+}
+
+/* exchange a channel's current state with the one kept aside */
+static void swap_channel(uint8_t channel, struct channel_state *c)
+{
+    struct channel_state t = *c;
+
+    save_channel(channel, c);
+    load_channel(channel, &t);
+}
+
+/* swap the song's state of the effect's channels in or out */
+static void swap_sfx_channels(uint8_t channels)
+{
+    uint8_t i;
+
+    for (i = 0; channels; i++, channels >>= 1)
+    {
+        if (channels & 0x1)
+            swap_channel(i, &song_channels[i]);
+    }
+}
+
+/* give the song back the channels in the given set */
+static void release_channels(uint8_t channels)
+{
+    uint8_t i;
+
+    channels &= sfx_channels;
+    for (i = 0; i < 4; i++)
+    {
+        if (channels & (1 << i))
+            load_channel(i, &song_channels[i]);
+    }
+    sfx_channels &= ~channels;
+}
+
+static uint8_t sfx_read_byte(void)
+{
+    return platform_read_byte(sfx_pos++);
+}
+
+static uint16_t sfx_read_word(void)
+{
+    uint16_t value = sfx_read_byte();
+
+    return value | (sfx_read_byte() << 8);
+}
+
+/* A sound effect is a short stream of events in the song format, */
+/* which takes over some channels from the song while it plays, as */
+/* the console's games do. The song's events for those channels are */
+/* still applied, to the state kept aside for them, so the channels */
+/* are handed back as if the song had been playing all along. */
+
+/* start the sound effect at addr (see synth.h) */
+/* returns 0 if one of higher priority is playing */
+uint8_t synth_play_sfx(uint32_t addr)
+{
+    uint8_t header = platform_read_byte(addr);
+    uint8_t channels = header & 0x0F;
+    uint8_t i;
+
+    if (sfx_pos && (header >> 4) < sfx_priority)
+        return 0;
+
+    /* channels the new effect doesn't use go back to the song, */
+    /* and those it takes from the song are kept aside and silenced, */
+    /* keeping the song's pitch, duty and pan until the effect sets */
+    /* its own */
+    release_channels(~channels);
+    for (i = 0; i < 4; i++)
+    {
+        if ((channels & (1 << i)) && !(sfx_channels & (1 << i)))
+        {
+            save_channel(i, &song_channels[i]);
+            volume[i] = 0;
+            length[i] = 0;
+            envelope[i].steps = 0;
+            sweep[i].steps = 0;
+        }
+    }
+
+    sfx_channels = channels;
+    sfx_priority = header >> 4;
+    sfx_pos = addr + 1;
+    sfx_wait = sfx_read_byte();
+
+    return 1;
+}
+
+/* end the sound effect, handing its channels back to the song */
+void synth_stop_sfx(void)
+{
+    release_channels(0x0F);
+    sfx_pos = 0;
+}
+
+/* apply the sound effect's events for the current frame */
+static void process_sfx(void)
+{
+    clock_units(sfx_channels);
+
+    while (!sfx_wait)
+    {
+        struct event e;
+
+        e.command = sfx_read_byte();
+        e.value = e.arg = 0;
+
+        switch (e.command & 0xF0)
+        {
+            /* the effect ends with a jump */
+            case 0xF0:
+                synth_stop_sfx();
+                return;
+            case 0x00:
+            case 0x50:
+                e.value = sfx_read_word();
+                break;
+            case 0x60:
+                e.value = sfx_read_word();
+                e.arg = sfx_read_byte();
+                break;
+            case 0x70:
+                e.value = sfx_read_word();
+                e.arg = sfx_read_word();
+                break;
+            case 0x10:
+            case 0x30:
+            case 0x40:
+            case 0x80:
+                e.value = sfx_read_byte();
+                break;
+            /* the rest only affect decoding a song, and are */
+            /* skipped with any operands, as the song decoder */
+            /* would read them */
+            case 0xA0:
+                sfx_read_byte();
+                sfx_wait = sfx_read_byte();
+                continue;
+            case 0xC0:
+                sfx_read_word();
+                sfx_wait = sfx_read_byte();
+                continue;
+            default:
+                sfx_wait = sfx_read_byte();
+                continue;
+        }
+
+        /* only the effect's own channels are touched */
+        if (sfx_channels & (1 << (e.command & 0x0F)))
+            apply_event(&e);
+
+        sfx_wait = sfx_read_byte();
+    }
+
+    sfx_wait--;
+}
+
+/* apply all events for the current frame and advance to the next one */
+/* returns 0 if there is no song to process */
+uint8_t synth_process_events(void)
+{
+    uint8_t channels = sfx_channels;
+
+    if (!song_start || !song_pos)
+        return 0;
+
+    /* the song's own state of any channels taken by a sound effect */
+    /* is swapped in while the song's events are applied */
+    swap_sfx_channels(channels);
+
+    clock_units(0x0F);
+
+    /* process all events for this frame */
+    while (1)
+    {
+        struct event *e;
+
+        /* normally the queue is kept filled while waiting for the */
+        /* next frame, but if it ran dry decode events right away */
+        while (!queue_count)
+            synth_prefetch();
+
+        e = &queue[queue_head];
+        if (e->frame != frame)
+            break;
+
+        apply_event(e);
+
+        queue_head = (queue_head + 1) & (EVENT_QUEUE_SIZE - 1);
+        queue_count--;
+    }
+
+    swap_sfx_channels(channels);
+    if (sfx_pos)
+        process_sfx();
+
+    /* increment frame count */
+    frame++;
+
+    return 1;
+}
+
+/* clock the noise lfsr, using the given second tap */
+static inline uint16_t clock_lfsr(uint16_t l, uint16_t tap)
+{
+    /* first tap is always lsb */
+    uint8_t fb = (l & 0x1) ^ ((l & tap) ? 1 : 0);
+
+    /* shift right */
+    l >>= 1;
+    /* load bit 14 to give a 15 bit lfsr */
+    if (fb)
+        l |= (1 << 14);
+
+    return l;
+}
+
+#ifdef BLEP
+/* the index into the residual tables for an edge dist into a step of s */
+/* inv is 0xFFFF / s, so this needs no division per edge */
+static inline uint8_t blep_index(uint16_t dist, uint16_t inv)
+{
+    return ((uint32_t) dist * inv) >> 12;
+}
+
+/* the residual for the first sample of a pass, which starts out at */
+/* level o, with a high level of v and a low level of nv */
+/* it is worked out again for the current levels, and dropped if the */
+/* channel isn't at the level the edge went to any more, since its */
+/* volume or duty may have changed since the last pass */
+static inline int8_t blep_resume(int8_t carry, int8_t o, int8_t v, int8_t nv)
+{
+    int16_t h = v - nv;
+
+    if (carry > 0 && o == v)
+        return -(h * carry) / 64;
+    if (carry < 0 && o == nv)
+        return (h * -carry) / 64;
+
+    return 0;
+}
+
+/* the carry to save at the end of a pass, given the residual c left */
+/* for the next sample, which is only set by an edge on the last */
+/* sample, the table index i of the last edge and the level o */
+static inline int8_t blep_save(int8_t c, uint8_t i, int8_t o, int8_t v)
+{
+    if (!c)
+        return 0;
+
+    return (o == v) ? blep_next[i] : -blep_next[i];
+}
+#endif
+
+#ifdef STEREO
+/* In stereo each channel's value is scaled by its left and right */
+/* gains as it is written to both halves of a sample, so both mixes */
+/* are built in the same pass over the channel */
+#define PAN_SCALE(value, gain) ((int8_t) (((value) * (gain)) >> 3))
+#define PASS_PAN(channel) \
+    uint8_t left = pan[channel] & 0x0F; \
+    uint8_t right = pan[channel] >> 4
+
+/* biases of the two sides, which differ by the panned level */
+/* of the silent triangle (see synth_render) */
+static uint8_t bias_left;
+static uint8_t bias_right;
+#else
+#define PASS_PAN(channel)
+#endif /* STEREO */
+
+/* Each audible channel is rendered across the whole buffer in its */
+/* own pass, so its state can stay in registers for the entire pass */
+/* instead of reloading the state of all four channels for every    */
+/* sample. The first pass stores to the buffer and the rest add to  */
+/* it. Since the mix never leaves the 0-255 range, this gives the   */
+/* same output as summing all channels for each sample.             */
+
+/* passes which store to the buffer */
+#define PASS(name) name##_store
+#ifdef STEREO
+#define PASS_OUT(buf, value) \
+    do \
+    { \
+        int8_t out_ = (value); \
+        (buf)[0] = bias_left + PAN_SCALE(out_, left); \
+        (buf)[1] = bias_right + PAN_SCALE(out_, right); \
+        (buf) += 2; \
+    } while (0)
+#else
+#define PASS_OUT(buf, value) (*(buf)++ = bias + (value))
+#endif
+#include "synth_pass.inc"
+#undef PASS
+#undef PASS_OUT
+
+/* passes which add to the buffer */
+#define PASS(name) name##_add
+#ifdef STEREO
+#define PASS_OUT(buf, value) \
+    do \
+    { \
+        int8_t out_ = (value); \
+        (buf)[0] += PAN_SCALE(out_, left); \
+        (buf)[1] += PAN_SCALE(out_, right); \
+        (buf) += 2; \
+    } while (0)
+#else
+#define PASS_OUT(buf, value) (*(buf)++ += (value))
+#endif
+#include "synth_pass.inc"
+#undef PASS
+#undef PASS_OUT
+
+/* Host builds can render the squares and triangle of the linear mono */
+/* mix with vector instructions, many samples at a time. */
+#if defined(HOST_SIMD) && defined(__SSE2__) && !defined(NES_MIXER) && \
+    !defined(STEREO) && !defined(BLEP)
+#define SYNTH_SIMD
+#include "synth_simd.inc"
+#endif
+
+/* to prevent pops in the output, caused by discontinuities,   */
+/* the triangle output is always 'on', but stays at a constant */
+/* value when not playing. This adds a DC offset, but its much */
+/* simpler than trying to filter it and the NES does the same. */
+/* When it is not playing, that constant is folded into the    */
+/* bias instead of being added sample by sample.               */
+static uint8_t triangle_rest(void)
+{
+    int8_t tmp = (((int16_t) phase[2]) >> 9);
+
+    if (tmp & 0x80)
+        tmp = -tmp;
+
+    return tmp;
+}
+
+/* render the square channels into buf */
+/* returns 1 if both are silent, and nothing was stored */
+static uint8_t render_squares(uint8_t *buf, uint16_t count, uint8_t bias)
+{
+    uint8_t first = 1;
+    uint8_t i;
+
+    /* square waves keep running when silent, but their phase can */
+    /* just be advanced for the whole buffer at once */
+    for (i = 0; i < 2; i++)
+    {
+        if (volume[i])
+        {
+            (first ? square_store : square_add)(buf, count, i, bias);
+            first = 0;
+        }
+        else
+        {
+            phase[i] += step[i] * count;
+#ifdef BLEP
+            blep_carry[i] = 0;
+#endif
+        }
+    }
+
+    return first;
+}
+
+/* render the triangle and noise channels into buf, storing */
+/* to it if first is set and adding to it otherwise */
+/* returns 1 if both are silent and first was set */
+static uint8_t render_tnd(uint8_t *buf, uint16_t count, uint8_t bias,
+                          uint8_t first)
+{
+    if (volume[2])
+    {
+        (first ? triangle_store : triangle_add)(buf, count, bias);
+        first = 0;
+    }
+
+    /* the lfsr is only clocked while the noise channel is on, */
+    /* so a silent noise channel has no state to update */
+    if (volume[3])
+    {
+        (first ? noise_store : noise_add)(buf, count, bias);
+        first = 0;
+    }
+#ifdef BLEP
+    else
+    {
+        blep_carry[3] = 0;
+    }
+#endif
+
+    return first;
+}
+
+#ifdef NES_MIXER
+/* look up the mix of count samples, from the square sums in buf */
+/* and the triangle and noise sums in tnd_buf */
+static void mix(uint8_t *buf, uint16_t count)
+{
+#ifdef DUAL_PWM
+    /* each sample is widened to two bytes in place, */
+    /* so this works back from the end */
+    uint8_t *out = buf + 2 * count;
+    const uint8_t *tnd = tnd_buf + count;
+
+    buf += count;
+    while (count--)
+    {
+        uint16_t v = pulse_table[*--buf] + tnd_table[*--tnd];
+
+        *--out = v & 0xFF;
+        *--out = v >> 8;
+    }
+#else
+    const uint8_t *tnd = tnd_buf;
+
+    while (count--)
+    {
+        *buf = (pulse_table[*buf] + tnd_table[*tnd++]) >> 8;
+        buf++;
+    }
+#endif /* DUAL_PWM */
+}
+
+/* render up to MIX_BLOCK samples */
+static void render_block(uint8_t *buf, uint16_t count)
+{
+    uint8_t bias = 0;
+
+    if (render_squares(buf, count, 0))
+        memset(buf, 0, count);
+
+    if (!volume[2])
+        bias = triangle_rest();
+    if (render_tnd(tnd_buf, count, bias, 1))
+        memset(tnd_buf, bias, count);
+
+    mix(buf, count);
+}
+
+void synth_render(uint8_t *buf, uint16_t count)
+{
+    while (count > MIX_BLOCK)
+    {
+        render_block(buf, MIX_BLOCK);
+        buf += MIX_BLOCK * SAMPLE_BYTES;
+        count -= MIX_BLOCK;
+    }
+
+    render_block(buf, count);
+}
+#elif defined(STEREO)
+void synth_render(uint8_t *buf, uint16_t count)
+{
+    uint8_t left = pan[2] & 0x0F;
+    uint8_t right = pan[2] >> 4;
+    uint8_t first;
+
+    /* as for mono, but with the triangle offset panned */
+    bias_left = 128 - PAN_SCALE(32, left);
+    bias_right = 128 - PAN_SCALE(32, right);
+
+    if (!volume[2])
+    {
+        int8_t rest = triangle_rest();
+
+        bias_left += PAN_SCALE(rest, left);
+        bias_right += PAN_SCALE(rest, right);
+    }
+
+    first = render_squares(buf, count, 0);
+    first = render_tnd(buf, count, 0, first);
+
+    /* nothing audible, so the output is constant */
+    while (first && count--)
+    {
+        *buf++ = bias_left;
+        *buf++ = bias_right;
+    }
+}
+#else
+void synth_render(uint8_t *buf, uint16_t count)
+{
+    /* normalize range to 0-255 */
+    /* 128 for DC offset and 32 for triangle offset */
+    uint8_t bias = 128 - 32;
+    uint8_t first;
+
+    if (!volume[2])
+        bias += triangle_rest();
+
+#ifdef SYNTH_SIMD
+    /* whole vectors first, then the rest as usual */
+    {
+        uint16_t n = count & ~(LANES - 1);
+
+        render_vector(buf, n, bias);
+        if (volume[3])
+            add_noise(buf, n);
+
+        buf += n;
+        count -= n;
+    }
+#endif
+
+    first = render_squares(buf, count, bias);
+    first = render_tnd(buf, count, bias, first);
+
+    /* nothing audible, so the output is constant */
+    if (first)
+        memset(buf, bias, count);
+}
+#endif /* NES_MIXER, STEREO */
+
+/* advance the channels by count samples without rendering them, */
+/* updating the state exactly as synth_render would, except that the */
+/* noise channel is left alone if exact is 0, since clocking its lfsr */
+/* is the only part which costs anything per sample */
+static void skip(uint16_t count, uint8_t exact)
+{
+    phase[0] += step[0] * count;
+    phase[1] += step[1] * count;
+
+    if (volume[2])
+        phase[2] += step[2] * count;
+
+    if (volume[3] && exact)
+    {
+        uint16_t p = phase[3];
+        uint16_t s = step[3];
+        uint16_t l = lfsr;
+        uint16_t tap = lfsr_mode ? (1 << 6) : (1 << 1);
+
+        while (count--)
+        {
+            p += s;
+            if (p & 0x8000)
+            {
+                l = clock_lfsr(l, tap);
+                p ^= 0x8000;
+            }
+        }
+
+        phase[3] = p;
+        lfsr = l;
+    }
+}
+
+static uint16_t read_word(uint32_t addr)
+{
+    return platform_read_byte(addr) | (platform_read_byte(addr + 1) << 8);
+}
+
+/* read a unit from a keyframe */
+static uint32_t load_unit(struct unit *u, uint32_t addr)
+{
+    u->delta = platform_read_byte(addr++);
+    u->period = platform_read_byte(addr++);
+    u->timer = platform_read_byte(addr++);
+    u->steps = platform_read_byte(addr++);
+
+    return addr;
+}
+
+/* restore the state saved in a keyframe (see synth.h for the layout) */
+static void load_keyframe(uint32_t addr)
+{
+    uint8_t i;
+
+    frame = read_word(addr);
+    last_frame = read_word(addr + 2);
+    song_pos = song_start + read_word(addr + 4);
+    song_repeat = song_start + read_word(addr + 6);
+    addr += 8;
+
+    for (i = 0; i < 4; i++)
+    {
+        set_step(i, read_word(addr));
+        phase[i] = read_word(addr + 2);
+        volume[i] = platform_read_byte(addr + 4);
+        addr = load_unit(&envelope[i], addr + 5);
+        addr = load_unit(&sweep[i], addr);
+        length[i] = platform_read_byte(addr++);
+    }
+
+    duty[0] = platform_read_byte(addr);
+    duty[1] = platform_read_byte(addr + 1);
+    lfsr = read_word(addr + 2);
+    lfsr_mode = platform_read_byte(addr + 4);
+    addr += 5;
+
+    for (i = 0; i < 4; i++)
+        pan[i] = platform_read_byte(addr++);
+
+    /* keyframe points are never inside patterns (see host/patpack.c) */
+    lz_seek(&lz, song_pos);
+    queue_head = queue_count = 0;
+    pattern_level = 0;
+    sync_pos = 0;
+    /* the restored state replaces whatever an effect had */
+    sfx_channels = 0;
+    sfx_pos = 0;
+}
+
+/* restore the last keyframe before the target frame, or rewind */
+/* the song if there is none, leaving the frames from there to the */
+/* target to be replayed with synth_skip_frame */
+/* returns the frame reached */
+uint16_t synth_seek_keyframe(uint16_t target)
+{
+    uint32_t best = 0;
+    uint16_t offset = 0;
+
+    if (!song_start)
+        return frame;
+
+    if (keyframes)
+    {
+        uint32_t addr = keyframes + SYNTH_SEEK_HEADER_SIZE;
+        uint8_t count = platform_read_byte(keyframes);
+        uint8_t loop = platform_read_byte(keyframes + 1);
+        uint16_t loop_frames = read_word(keyframes + 2);
+
+        /* a target past the second pass through the looping part is */
+        /* moved back into it, and the frame numbers moved forward again */
+        /* after restoring a keyframe. Only the phases and lfsr differ */
+        /* from where playback would really be. */
+        if (loop)
+        {
+            uint16_t loop_start = read_word(addr + loop * SYNTH_KEYFRAME_SIZE);
+
+            if ((uint32_t) target >= (uint32_t) loop_start + loop_frames)
+            {
+                offset = target - loop_start;
+                offset -= offset % loop_frames;
+                target -= offset;
+            }
+        }
+
+        /* keyframes are in order of frame */
+        while (count-- && read_word(addr) <= target)
+        {
+            best = addr;
+            addr += SYNTH_KEYFRAME_SIZE;
+        }
+    }
+
+    if (best)
+    {
+        load_keyframe(best);
+        frame += offset;
+        last_frame += offset;
+    }
+    else
+    {
+        synth_reset();
+    }
+
+    return frame;
+}
+
+/* move playback to the start of the target frame, by restoring the */
+/* last keyframe before it and replaying the frames from there */
+/* exactly, which costs as much per sample as rendering the noise */
+/* returns the frame reached, which is earlier than the target if */
+/* the replay would take longer than SYNTH_MAX_REPLAY frames */
+uint16_t synth_seek(uint16_t target)
+{
+    uint16_t start;
+
+    if (!song_start)
+        return frame;
+
+    start = synth_seek_keyframe(target);
+
+    if (target - start > SYNTH_MAX_REPLAY)
+        target = start + SYNTH_MAX_REPLAY;
+
+    while (frame != target)
+    {
+        synth_process_events();
+        skip(samples_per_frame, 1);
+    }
+
+    return frame;
+}
+
+/* apply the events of the current frame and advance to the next one */
+/* without rendering it, for fast forwarding */
+/* playback afterwards isn't bit-exact, since the noise lfsr is skipped */
+/* returns 0 if there is no song to process */
+uint8_t synth_skip_frame(void)
+{
+    if (!synth_process_events())
+        return 0;
+
+    skip(samples_per_frame, 0);
+
+    return 1;
+}
+
+#ifndef __AVR__
+static uint8_t *save_word(uint8_t *buf, uint16_t value)
+{
+    *buf++ = value & 0xFF;
+    *buf++ = value >> 8;
+
+    return buf;
+}
+
+static uint8_t *save_unit(uint8_t *buf, const struct unit *u)
+{
+    *buf++ = u->delta;
+    *buf++ = u->period;
+    *buf++ = u->timer;
+    *buf++ = u->steps;
+
+    return buf;
+}
+
+/* save the state at the start of the current frame as a keyframe, */
+/* which is only possible just after a keyframe point was decoded */
+/* by the last call to synth_process_events */
+/* returns 0 if that is not the case */
+uint8_t synth_save_keyframe(uint8_t *buf)
+{
+    uint8_t i;
+
+    if (!sync_pos || (uint16_t) (sync_frame + 1) != frame)
+        return 0;
+
+    buf = save_word(buf, frame);
+    buf = save_word(buf, sync_frame);
+    buf = save_word(buf, sync_pos - song_start);
+    buf = save_word(buf, song_repeat - song_start);
+
+    for (i = 0; i < 4; i++)
+    {
+        buf = save_word(buf, song_step[i]);
+        buf = save_word(buf, phase[i]);
+        *buf++ = volume[i];
+        buf = save_unit(buf, &envelope[i]);
+        buf = save_unit(buf, &sweep[i]);
+        *buf++ = length[i];
+    }
+
+    *buf++ = duty[0];
+    *buf++ = duty[1];
+    buf = save_word(buf, lfsr);
+    *buf++ = lfsr_mode;
+
+    for (i = 0; i < 4; i++)
+        *buf++ = pan[i];
+
+    return 1;
+}
+#endif /* __AVR__ */
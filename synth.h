@@ -0,0 +1,136 @@
+/* File:    synth.h
+   Author:  Frank Dischner
+   Purpose: Contains prototypes for the hardware independent synthesis core,
+            which decodes song events and renders samples
+*/
+
+#ifndef SYNTH_H
+#define SYNTH_H
+
+/* songs are written for a 40kHz output, and their step values are */
+/* scaled to match any other rate (see synth_set_rate) */
+#define SONG_SAMPLE_RATE 40000
+
+/* range of supported output rates */
+#define MIN_SAMPLE_RATE 20000
+#define MAX_SAMPLE_RATE 48000
+
+/* frames per second, NTSC or PAL */
+#define FRAME_RATE_NTSC 60
+#define FRAME_RATE_PAL  50
+
+/* output rate and frame rate the core starts out with */
+#ifndef SAMPLE_RATE
+#define SAMPLE_RATE 40000
+#endif
+#ifndef FRAME_RATE
+#define FRAME_RATE FRAME_RATE_NTSC
+#endif
+
+/* samples per frame, rounded to the nearest sample */
+#define SAMPLES_PER_FRAME_AT(rate, fps) (((rate) + (fps) / 2) / (fps))
+#define SAMPLES_PER_FRAME SAMPLES_PER_FRAME_AT(SAMPLE_RATE, FRAME_RATE)
+/* for sizing frame buffers */
+#define MAX_SAMPLES_PER_FRAME \
+    SAMPLES_PER_FRAME_AT(MAX_SAMPLE_RATE, FRAME_RATE_PAL)
+
+/* Channels are normally mixed by adding them up, which gives one byte */
+/* per sample. With NES_MIXER they are mixed through lookup tables */
+/* instead, following the console's nonlinear DAC, and with DUAL_PWM */
+/* the mix is output at 16 bits as two bytes per sample, the high byte */
+/* first, for two PWM outputs combined with weighted resistors. */
+/* With STEREO each sample is a left and a right byte instead, from */
+/* the linear mix with each channel panned. */
+#if defined(DUAL_PWM) && !defined(NES_MIXER)
+#error DUAL_PWM needs NES_MIXER
+#endif
+#if defined(STEREO) && defined(NES_MIXER)
+#error STEREO needs the linear mix
+#endif
+
+#if defined(DUAL_PWM) || defined(STEREO)
+#define SAMPLE_BYTES 2
+#else
+#define SAMPLE_BYTES 1
+#endif
+
+/* the constants above are also used by the assembly interrupt */
+#ifndef __ASSEMBLER__
+
+#include <stdint.h>
+
+/* or'd with a song address if its data is compressed (see lz.h) */
+#define SONG_COMPRESSED 0x80000000UL
+
+/* operand of a pan event (0x80), with gains from 0 (off) */
+/* to 8 (full) in eighths of the channel's level */
+#define SYNTH_PAN(left, right) ((left) | ((right) << 4))
+#define SYNTH_PAN_CENTER SYNTH_PAN(8, 8)
+
+/* A seek index is a header of SYNTH_SEEK_HEADER_SIZE bytes:
+
+       number of keyframes,
+       index of the first keyframe in the second pass through the
+       looping part of the song (0 if that part has no keyframes),
+       frames per pass through the looping part (16-bit)
+
+   followed by the keyframes, in order of frame. These cover the first
+   pass through the song and then the second pass through the looping
+   part, which later passes are seeked into.
+
+   Each keyframe is the state of the synthesis core at the start of a
+   frame, just after a keyframe point in the song was decoded, so decoding
+   can be restarted there. It is stored as SYNTH_KEYFRAME_SIZE bytes, with
+   16-bit values little endian:
+
+       frame, frame of the last decoded event,
+       decoder position and repeat point (offsets from the song start),
+       then for each channel:
+           step, phase, volume,
+           envelope and sweep (delta, period, timer and steps), length,
+       duty[2], lfsr, lfsr mode, pan[4]
+
+   Seek indexes are generated at build time by host/seekgen, which plays
+   the song at SAMPLE_RATE and FRAME_RATE. Seeking at any other rate
+   restores the same state, but the phases then differ from where
+   playback would really be. */
+#define SYNTH_SEEK_HEADER_SIZE 4
+#define SYNTH_KEYFRAME_SIZE    73
+
+/* longest replay done for a seek, in frames */
+#define SYNTH_MAX_REPLAY 600
+
+/* A sound effect is a stream of events in the song format, which is
+   played over the song on the channels it takes, and ends with a jump
+   (0xF0). It starts with a header byte of SYNTH_SFX_HEADER(channels,
+   priority), with bit n of channels set for channel n, and an effect
+   only replaces another of at most its own priority (0-15). Its events
+   for other channels are ignored. Only channel events (0x00-0x80) are
+   played, and keyframe and repeat points, loops and patterns are
+   skipped over.
+   Seeking, or changing or restarting the song, ends it. */
+#define SYNTH_SFX_HEADER(channels, priority) ((channels) | ((priority) << 4))
+
+void synth_reset(void);
+void synth_set_song(uint32_t addr);
+void synth_set_keyframes(uint32_t addr);
+uint8_t synth_set_rate(uint16_t rate, uint8_t fps);
+uint16_t synth_get_rate(void);
+uint8_t synth_get_frame_rate(void);
+uint16_t synth_samples_per_frame(void);
+uint16_t synth_get_frame(void);
+uint8_t synth_prefetch(void);
+uint8_t synth_process_events(void);
+void synth_render(uint8_t *buf, uint16_t count);
+uint16_t synth_seek_keyframe(uint16_t target);
+uint16_t synth_seek(uint16_t target);
+uint8_t synth_skip_frame(void);
+uint8_t synth_play_sfx(uint32_t addr);
+void synth_stop_sfx(void);
+#ifndef __AVR__
+uint8_t synth_save_keyframe(uint8_t *buf);
+#endif
+
+#endif /* __ASSEMBLER__ */
+
+#endif /* SYNTH_H */